@@ -0,0 +1,303 @@
+// Batch processing for the MIDI tools
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#include <dirent.h>
+#include <strings.h>	// for strcasecmp()
+#endif
+
+#include <stdtype.h>
+#include "MidiLib.hpp"
+#include "MidiBatch.hpp"
+#include "MidiStats.hpp"
+
+#ifdef _MSC_VER
+#define stricmp		_stricmp
+#else
+#define stricmp		strcasecmp
+#endif
+
+#ifdef _WIN32
+#define PATH_SEP	'\\'
+#else
+#define PATH_SEP	'/'
+#endif
+
+#ifdef _WIN32
+#define fnamecmp	stricmp	// file names are case-insensitive on Windows
+#else
+#define fnamecmp	strcmp
+#endif
+
+#define NO_DUPLICATE	((size_t)-1)
+
+
+struct BatchJob
+{
+	BATCH_FUNC func;
+	const std::string* outPath;
+	const std::vector<std::string>* fileList;
+	UINT8* retVals;
+	FileStats* stats;	// NULL = no statistics
+	const size_t* dupOf;	// index of the earlier file with the same output name, or NO_DUPLICATE
+};
+
+struct FileNameLess
+{
+	const std::vector<std::string>* fileList;
+	bool operator()(size_t a, size_t b) const;
+};
+
+
+static bool IsDirectory(const char* path);
+static bool IsMidiFileName(const char* fileName);
+static UINT8 ListDirectory(const std::string& dirPath, std::vector<std::string>& fileList);
+static UINT8 ReadFileList(const char* listFile, std::vector<std::string>& fileList);
+static const char* GetFileNamePart(const char* filePath);
+static size_t FindDuplicateNames(const std::vector<std::string>& fileList, std::vector<size_t>& dupOf);
+static void BatchFileFunc(void* userData, size_t index);
+
+
+UINT32 RunBatch(const char* inPath, const char* outPath, UINT32 thrCount, BATCH_FUNC func, UINT8 statsMode)
+{
+	std::vector<std::string> fileList;
+	std::vector<UINT8> retVals;
+	std::vector<FileStats> stats;
+	std::vector<size_t> dupOf;
+	std::string outDir;
+	BatchJob job;
+	size_t curFile;
+	UINT32 errCnt;
+	UINT8 retVal;
+	
+	if (IsDirectory(inPath))
+		retVal = ListDirectory(inPath, fileList);
+	else
+		retVal = ReadFileList(inPath, fileList);
+	if (retVal)
+	{
+		printf("Unable to read file list from %s!\n", inPath);
+		return 1;
+	}
+	
+	outDir = outPath;
+	if (! outDir.empty() && outDir[outDir.length() - 1] != '/' && outDir[outDir.length() - 1] != PATH_SEP)
+		outDir += PATH_SEP;
+	
+	// Files from different directories may share a name and would write the same output file concurrently,
+	// so only the first one of them is processed.
+	if (FindDuplicateNames(fileList, dupOf) > 0)
+		printf("Warning: Some files have the same name and will be skipped!\n");
+	
+	printf("Processing %u files ...\n", (unsigned)fileList.size());
+	retVals.resize(fileList.size());
+	job.func = func;
+	job.outPath = &outDir;
+	job.fileList = &fileList;
+	job.retVals = retVals.empty() ? NULL : &retVals[0];
+	job.stats = NULL;
+	job.dupOf = dupOf.empty() ? NULL : &dupOf[0];
+	if (statsMode != STATS_OFF && ! fileList.empty())
+	{
+		stats.resize(fileList.size());
+		job.stats = &stats[0];
+	}
+	RunParallel(fileList.size(), &BatchFileFunc, &job, thrCount);
+	
+	// print the summary after all threads are done, so that the lines aren't mixed up
+	errCnt = 0;
+	for (curFile = 0; curFile < fileList.size(); curFile ++)
+	{
+		if (dupOf[curFile] != NO_DUPLICATE)
+		{
+			printf("%s: Skipped, same output file as %s\n", fileList[curFile].c_str(),
+					fileList[dupOf[curFile]].c_str());
+			errCnt ++;
+		}
+		else if (retVals[curFile])
+		{
+			printf("%s: Error 0x%02X\n", fileList[curFile].c_str(), retVals[curFile]);
+			errCnt ++;
+		}
+		else
+		{
+			printf("%s: OK\n", fileList[curFile].c_str());
+		}
+	}
+	printf("%u files processed, %u failed.\n", (unsigned)fileList.size(), errCnt);
+	
+	if (statsMode != STATS_OFF)
+	{
+		fflush(stdout);
+		for (curFile = 0; curFile < stats.size(); curFile ++)
+			PrintFileStats(fileList[curFile].c_str(), retVals[curFile], stats[curFile], statsMode);
+		PrintStatsSummary(statsMode);
+	}
+	
+	return errCnt;
+}
+
+static void BatchFileFunc(void* userData, size_t index)
+{
+	BatchJob* job = (BatchJob*)userData;
+	const std::string& inName = (*job->fileList)[index];
+	std::string outName = *job->outPath + GetFileNamePart(inName.c_str());
+	
+	FileStats* stats = (job->stats != NULL) ? &job->stats[index] : NULL;
+	
+	ClearFileStats(stats);
+	if (job->dupOf[index] != NO_DUPLICATE)
+	{
+		job->retVals[index] = 0xFF;
+		return;
+	}
+	job->retVals[index] = job->func(inName.c_str(), outName.c_str(), stats);
+	EndFileStats(stats);
+	
+	return;
+}
+
+static bool IsDirectory(const char* path)
+{
+#ifdef _WIN32
+	DWORD attrs = GetFileAttributesA(path);
+	return (attrs != INVALID_FILE_ATTRIBUTES) && (attrs & FILE_ATTRIBUTE_DIRECTORY);
+#else
+	struct stat fileStat;
+	return ! stat(path, &fileStat) && S_ISDIR(fileStat.st_mode);
+#endif
+}
+
+static bool IsMidiFileName(const char* fileName)
+{
+	const char* fileExt = strrchr(fileName, '.');
+	if (fileExt == NULL)
+		return false;
+	return ! stricmp(fileExt, ".mid") || ! stricmp(fileExt, ".midi");
+}
+
+static UINT8 ListDirectory(const std::string& dirPath, std::vector<std::string>& fileList)
+{
+	std::string basePath;
+	
+	basePath = dirPath;
+	if (! basePath.empty() && basePath[basePath.length() - 1] != '/' && basePath[basePath.length() - 1] != PATH_SEP)
+		basePath += PATH_SEP;
+#ifdef _WIN32
+	WIN32_FIND_DATAA findData;
+	HANDLE hFind;
+	
+	hFind = FindFirstFileA((basePath + "*").c_str(), &findData);
+	if (hFind == INVALID_HANDLE_VALUE)
+		return 0xFF;
+	do
+	{
+		if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			continue;
+		if (IsMidiFileName(findData.cFileName))
+			fileList.push_back(basePath + findData.cFileName);
+	} while(FindNextFileA(hFind, &findData));
+	FindClose(hFind);
+#else
+	DIR* hDir;
+	struct dirent* dirEntry;
+	
+	hDir = opendir(dirPath.c_str());
+	if (hDir == NULL)
+		return 0xFF;
+	while((dirEntry = readdir(hDir)) != NULL)
+	{
+		std::string filePath = basePath + dirEntry->d_name;
+		if (IsMidiFileName(dirEntry->d_name) && ! IsDirectory(filePath.c_str()))
+			fileList.push_back(filePath);
+	}
+	closedir(hDir);
+#endif
+	std::sort(fileList.begin(), fileList.end());
+	
+	return 0x00;
+}
+
+static UINT8 ReadFileList(const char* listFile, std::vector<std::string>& fileList)
+{
+	std::ifstream hFile;
+	std::string line;
+	size_t lineLen;
+	
+	hFile.open(listFile);
+	if (! hFile.is_open())
+		return 0xFF;
+	
+	while(std::getline(hFile, line))
+	{
+		lineLen = line.length();
+		while(lineLen > 0 && line[lineLen - 1] == '\r')
+			lineLen --;
+		if (lineLen > 0)
+			fileList.push_back(line.substr(0, lineLen));
+	}
+	hFile.close();
+	
+	return 0x00;
+}
+
+static const char* GetFileNamePart(const char* filePath)
+{
+	const char* sepPos;
+	const char* fileTitle;
+	
+	fileTitle = filePath;
+	for (sepPos = filePath; *sepPos != '\0'; sepPos ++)
+	{
+		if (*sepPos == '/' || *sepPos == '\\')
+			fileTitle = sepPos + 1;
+	}
+	
+	return fileTitle;
+}
+
+bool FileNameLess::operator()(size_t a, size_t b) const
+{
+	return fnamecmp(GetFileNamePart((*fileList)[a].c_str()), GetFileNamePart((*fileList)[b].c_str())) < 0;
+}
+
+static size_t FindDuplicateNames(const std::vector<std::string>& fileList, std::vector<size_t>& dupOf)
+{
+	std::vector<size_t> order;
+	FileNameLess nameLess;
+	size_t curFile;
+	size_t firstFile;
+	size_t dupCnt;
+	
+	dupOf.assign(fileList.size(), NO_DUPLICATE);
+	order.resize(fileList.size());
+	for (curFile = 0; curFile < order.size(); curFile ++)
+		order[curFile] = curFile;
+	nameLess.fileList = &fileList;
+	// stable sort, so that the first file of each group keeps its output name
+	std::stable_sort(order.begin(), order.end(), nameLess);
+	
+	dupCnt = 0;
+	firstFile = 0;
+	for (curFile = 1; curFile < order.size(); curFile ++)
+	{
+		if (nameLess(order[firstFile], order[curFile]))
+		{
+			firstFile = curFile;
+			continue;
+		}
+		dupOf[order[curFile]] = order[firstFile];
+		dupCnt ++;
+	}
+	
+	return dupCnt;
+}
@@ -0,0 +1,21 @@
+#ifndef __MIDIBATCH_HPP__
+#define __MIDIBATCH_HPP__
+
+#include <stdtype.h>
+
+struct FileStats;
+
+// converts a single file, returns 0x00 on success
+// stats is NULL when no statistics are requested.
+// Note: The function is called from multiple threads at once.
+typedef UINT8 (*BATCH_FUNC)(const char* inFileName, const char* outFileName, FileStats* stats);
+
+// Calls func for every file listed by inPath and prints a status line per file.
+// inPath is either a directory (all .mid files are processed) or a text file with one file name per line.
+// The output files are written to the directory outPath, using the same file names.
+// thrCount = 0: use one thread per CPU
+// statsMode: STATS_OFF/TEXT/JSON (see MidiStats.hpp), the statistics are printed after the summary
+// Returns the number of files that failed.
+UINT32 RunBatch(const char* inPath, const char* outPath, UINT32 thrCount, BATCH_FUNC func, UINT8 statsMode);
+
+#endif	// __MIDIBATCH_HPP__
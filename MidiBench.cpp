@@ -0,0 +1,832 @@
+// MIDI Benchmark
+// --------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>	// for tolower()
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <stdtype.h>
+#include "MidiLib.hpp"
+#include "MidiStats.hpp"
+#include "MidiEventSortLib.hpp"
+#include "MidiSpltLib.hpp"
+#include "MidiVolConvLib.hpp"
+
+#define TEMP_FILE_NAME	"MidiBench.tmp"	// output file of the streaming tests, deleted afterwards
+#define TEMP_CORPUS_NAME	"MidiBench_in.tmp"	// generated corpus file for the mapped loading test, deleted afterwards
+
+
+struct CorpusFile
+{
+	std::string name;
+	std::string path;	// file on disk (input file or temporary copy of a generated one)
+	std::vector<UINT8> data;
+	UINT32 evtCount;
+};
+struct PendingNote
+{
+	UINT32 tick;	// tick of the Note Off
+	UINT8 chn;
+	UINT8 note;
+};
+
+typedef void (*FuncGenerate)(MidiFile& midFile, UINT32 evtCount);
+struct GEN_PRESET
+{
+	const char* name;
+	FuncGenerate func;
+};
+// returns the measured time in seconds
+typedef double (*FuncBenchmark)(const CorpusFile& cFile);
+struct BENCH_TEST
+{
+	const char* name;
+	FuncBenchmark func;
+};
+
+
+// Function Prototypes
+static UINT32 GetRandom(UINT32 range);
+static UINT8 ReadFileData(const char* fileName, std::vector<UINT8>& fileData);
+static UINT8 WriteFileData(const char* fileName, const std::vector<UINT8>& fileData);
+static UINT32 CountEvents(MidiFile& midFile);
+static void GenerateCorpus(const GEN_PRESET& preset, UINT32 evtCount, CorpusFile& cFile);
+// corpus generators
+static void AppendNoteOffs(MidiTrack* midTrk, std::vector<PendingNote>& notes, UINT32 tick);
+static void AppendNoteOn(MidiTrack* midTrk, std::vector<PendingNote>& notes, UINT32 tick, UINT8 chn, UINT8 note, UINT8 vel, UINT32 len);
+static void PrepareTrack(MidiTrack* midTrk, UINT16 trkID, UINT8 chn, UINT8 ins);
+static void Gen_Notes(MidiFile& midFile, UINT32 evtCount);
+static void Gen_Chords(MidiFile& midFile, UINT32 evtCount);
+static void Gen_Ctrls(MidiFile& midFile, UINT32 evtCount);
+static void Gen_SysEx(MidiFile& midFile, UINT32 evtCount);
+static void Gen_Tracks(MidiFile& midFile, UINT32 evtCount);
+// benchmarks
+static void BenchmarkFile(const CorpusFile& cFile);
+static double Bench_Load(const CorpusFile& cFile);
+static double Bench_LoadMapped(const CorpusFile& cFile);
+static double Bench_Save(const CorpusFile& cFile);
+static double Bench_SaveCompact(const CorpusFile& cFile);
+static double Bench_ReadEvents(const CorpusFile& cFile);
+static double Bench_Format0(const CorpusFile& cFile);
+static double Bench_Resolution(const CorpusFile& cFile);
+static double Bench_TempoMap(const CorpusFile& cFile);
+static double Bench_EventSort(const CorpusFile& cFile);
+static double Bench_VolConv(const CorpusFile& cFile);
+static double Bench_Split(const CorpusFile& cFile, UINT8 spltMode);
+static double Bench_SplitChn(const CorpusFile& cFile);
+static double Bench_SplitChord(const CorpusFile& cFile);
+static double Bench_SplitIns(const CorpusFile& cFile);
+static double Bench_SplitVel(const CorpusFile& cFile);
+static double Bench_SplitKey(const CorpusFile& cFile);
+
+
+static const GEN_PRESET GenPresets[] =
+{
+	{"notes", &Gen_Notes},	// 16 tracks with melodies
+	{"chords", &Gen_Chords},	// overlapping chords with up to 12 notes
+	{"ctrls", &Gen_Ctrls},	// dense controllers and pitch bends
+	{"sysex", &Gen_SysEx},	// big SysEx messages between notes
+	{"tracks", &Gen_Tracks},	// many small tracks
+	{NULL, NULL}
+};
+static const BENCH_TEST BenchTests[] =
+{
+	{"Load", &Bench_Load},
+	{"Load (mapped)", &Bench_LoadMapped},
+	{"Save", &Bench_Save},
+	{"Save (compact)", &Bench_SaveCompact},
+	{"Read Events", &Bench_ReadEvents},
+	{"Format 0", &Bench_Format0},
+	{"Resolution", &Bench_Resolution},
+	{"Tempo Map", &Bench_TempoMap},
+	{"Event Sort", &Bench_EventSort},
+	{"Volume Conv", &Bench_VolConv},
+	{"Split chn", &Bench_SplitChn},
+	{"Split chord", &Bench_SplitChord},
+	{"Split ins", &Bench_SplitIns},
+	{"Split vel", &Bench_SplitVel},
+	{"Split key", &Bench_SplitKey},
+	{NULL, NULL}
+};
+
+static UINT32 EVENT_COUNT;
+static UINT32 REPEAT_COUNT;
+static const char* PRESET_NAME;
+static const char* CORPUS_DIR;
+static UINT32 rngState;
+
+int main(int argc, char* argv[])
+{
+	int argbase;
+	std::vector<CorpusFile> corpus;
+	size_t curFile;
+	
+	printf("MIDI Benchmark\n");
+	printf("--------------\n");
+	
+	argbase = 1;
+	EVENT_COUNT = 1000000;
+	REPEAT_COUNT = 3;
+	PRESET_NAME = NULL;
+	CORPUS_DIR = NULL;
+	while(argbase < argc && argv[argbase][0] == '-')
+	{
+		char optChr = tolower(argv[argbase][1]);
+		
+		if (optChr == 'h' || optChr == '?')
+		{
+			printf("Usage: %s [options] [input.mid ...]\n", argv[0]);
+			printf("Runs the benchmarks on the given files or on a generated corpus.\n");
+			printf("Options:\n");
+			printf("    -n num  - number of events per generated file (default: 1000000)\n");
+			printf("    -p name - generate a single preset only\n");
+			printf("              notes, chords, ctrls, sysex, tracks\n");
+			printf("    -r num  - repetitions per test, the fastest one is reported (default: 3)\n");
+			printf("    -w dir  - write the generated corpus into a directory instead of running the benchmarks\n");
+			return 0;
+		}
+		else if (optChr == 'n' || optChr == 'p' || optChr == 'r' || optChr == 'w')
+		{
+			argbase ++;
+			if (argbase >= argc)
+				break;
+			
+			if (optChr == 'n')
+				EVENT_COUNT = (UINT32)strtoul(argv[argbase], NULL, 0);
+			else if (optChr == 'p')
+				PRESET_NAME = argv[argbase];
+			else if (optChr == 'r')
+				REPEAT_COUNT = (UINT32)strtoul(argv[argbase], NULL, 0);
+			else if (optChr == 'w')
+				CORPUS_DIR = argv[argbase];
+		}
+		else
+		{
+			break;
+		}
+		argbase ++;
+	}
+	if (! EVENT_COUNT)
+		EVENT_COUNT = 1;
+	if (! REPEAT_COUNT)
+		REPEAT_COUNT = 1;
+	
+	if (argbase < argc)
+	{
+		for (; argbase < argc; argbase ++)
+		{
+			CorpusFile cFile;
+			MidiFile midFile;
+			
+			cFile.name = argv[argbase];
+			cFile.path = argv[argbase];
+			if (ReadFileData(argv[argbase], cFile.data) || midFile.LoadFile((UINT32)cFile.data.size(), &cFile.data[0]))
+			{
+				printf("Error reading %s!\n", argv[argbase]);
+				continue;
+			}
+			cFile.evtCount = CountEvents(midFile);
+			corpus.push_back(cFile);
+		}
+	}
+	else
+	{
+		const GEN_PRESET* preset;
+		
+		for (preset = GenPresets; preset->name != NULL; preset ++)
+		{
+			if (PRESET_NAME != NULL && strcmp(PRESET_NAME, preset->name))
+				continue;
+			printf("Generating %s ...\n", preset->name);
+			corpus.push_back(CorpusFile());
+			GenerateCorpus(*preset, EVENT_COUNT, corpus.back());
+		}
+		if (corpus.empty())
+		{
+			printf("Unknown preset!\n");
+			return 1;
+		}
+	}
+	
+	if (CORPUS_DIR != NULL)
+	{
+		for (curFile = 0; curFile < corpus.size(); curFile ++)
+		{
+			std::string fileName = std::string(CORPUS_DIR) + "/" + corpus[curFile].name + ".mid";
+			if (WriteFileData(fileName.c_str(), corpus[curFile].data))
+			{
+				printf("Error writing %s!\n", fileName.c_str());
+				return 2;
+			}
+			printf("%s: %u events\n", fileName.c_str(), corpus[curFile].evtCount);
+		}
+		return 0;
+	}
+	
+	for (curFile = 0; curFile < corpus.size(); curFile ++)
+	{
+		CorpusFile& cFile = corpus[curFile];
+		bool tempFile = cFile.path.empty();
+		
+		// generated files are written to disk for the mapped loading test
+		if (tempFile)
+		{
+			cFile.path = TEMP_CORPUS_NAME;
+			if (WriteFileData(cFile.path.c_str(), cFile.data))
+				cFile.path.clear();
+		}
+		BenchmarkFile(cFile);
+		if (tempFile && ! cFile.path.empty())
+			remove(cFile.path.c_str());
+	}
+	
+	return 0;
+}
+
+// simple LCG, so that the corpus is the same on all platforms
+static UINT32 GetRandom(UINT32 range)
+{
+	rngState = rngState * 1103515245 + 12345;
+	return (rngState >> 8) % range;
+}
+
+static UINT8 ReadFileData(const char* fileName, std::vector<UINT8>& fileData)
+{
+	FILE* hFile;
+	long fileSize;
+	
+	hFile = fopen(fileName, "rb");
+	if (hFile == NULL)
+		return 0xFF;
+	
+	fseek(hFile, 0, SEEK_END);
+	fileSize = ftell(hFile);
+	rewind(hFile);
+	if (fileSize <= 0)
+	{
+		fclose(hFile);
+		return 0x10;
+	}
+	fileData.resize(fileSize);
+	fileData.resize(fread(&fileData[0], 1, fileSize, hFile));
+	fclose(hFile);
+	
+	return 0x00;
+}
+
+static UINT8 WriteFileData(const char* fileName, const std::vector<UINT8>& fileData)
+{
+	FILE* hFile;
+	size_t wrtBytes;
+	
+	hFile = fopen(fileName, "wb");
+	if (hFile == NULL)
+		return 0xFF;
+	
+	wrtBytes = fwrite(&fileData[0], 1, fileData.size(), hFile);
+	fclose(hFile);
+	
+	return (wrtBytes == fileData.size()) ? 0x00 : 0x10;
+}
+
+static UINT32 CountEvents(MidiFile& midFile)
+{
+	UINT32 evtCount;
+	UINT16 curTrk;
+	
+	evtCount = 0;
+	for (curTrk = 0; curTrk < midFile.GetTrackCount(); curTrk ++)
+		evtCount += midFile.GetTrack(curTrk)->GetEventCount();
+	
+	return evtCount;
+}
+
+static void GenerateCorpus(const GEN_PRESET& preset, UINT32 evtCount, CorpusFile& cFile)
+{
+	MidiFile midFile;
+	UINT32 dataLen;
+	UINT8* data;
+	
+	rngState = 0x4D546864;	// "MThd", so that each preset is always the same
+	midFile.SetMidiFormat(1);
+	midFile.SetMidiResolution(480);
+	preset.func(midFile, evtCount);
+	
+	cFile.name = preset.name;
+	cFile.evtCount = CountEvents(midFile);
+	if (midFile.SaveFile(&dataLen, &data))
+	{
+		cFile.data.clear();
+		return;
+	}
+	cFile.data.assign(data, data + dataLen);
+	free(data);
+	
+	return;
+}
+
+static void AppendNoteOffs(MidiTrack* midTrk, std::vector<PendingNote>& notes, UINT32 tick)
+{
+	// "notes" is sorted by tick, in descending order
+	while(! notes.empty() && notes.back().tick <= tick)
+	{
+		const PendingNote& pn = notes.back();
+		midTrk->AppendEvent(pn.tick - midTrk->GetTickCount(), 0x90 | pn.chn, pn.note, 0x00);
+		notes.pop_back();
+	}
+	
+	return;
+}
+
+static bool pendnote_compare(const PendingNote& first, const PendingNote& second)
+{
+	return (first.tick > second.tick);
+}
+
+static void AppendNoteOn(MidiTrack* midTrk, std::vector<PendingNote>& notes, UINT32 tick, UINT8 chn, UINT8 note, UINT8 vel, UINT32 len)
+{
+	PendingNote pn;
+	
+	AppendNoteOffs(midTrk, notes, tick);
+	midTrk->AppendEvent(tick - midTrk->GetTickCount(), 0x90 | chn, note, vel);
+	
+	pn.tick = tick + len;
+	pn.chn = chn;
+	pn.note = note;
+	notes.insert(std::upper_bound(notes.begin(), notes.end(), pn, pendnote_compare), pn);
+	
+	return;
+}
+
+static void PrepareTrack(MidiTrack* midTrk, UINT16 trkID, UINT8 chn, UINT8 ins)
+{
+	char trkName[0x20];
+	
+	sprintf(trkName, "Track %u", trkID);
+	midTrk->AppendMetaEvent(0, 0x03, (UINT32)strlen(trkName), trkName);
+	if (trkID == 0)
+	{
+		static const UINT8 tempoData[3] = {0x07, 0xA1, 0x20};	// 120 BPM
+		midTrk->AppendMetaEvent(0, 0x51, 3, tempoData);
+	}
+	midTrk->AppendEvent(0, 0xB0 | chn, 0x00, 0x00);
+	midTrk->AppendEvent(0, 0xC0 | chn, ins, 0x00);
+	midTrk->AppendEvent(0, 0xB0 | chn, 0x07, 100);
+	
+	return;
+}
+
+static void Gen_Notes(MidiFile& midFile, UINT32 evtCount)
+{
+	UINT16 curTrk;
+	
+	for (curTrk = 0; curTrk < 16; curTrk ++)
+	{
+		MidiTrack* midTrk = midFile.NewTrack_Append();
+		std::vector<PendingNote> notes;
+		UINT8 chn = (UINT8)curTrk;
+		UINT8 note = 60;
+		UINT32 tick = 0;
+		
+		PrepareTrack(midTrk, curTrk, chn, (UINT8)GetRandom(0x80));
+		while(midTrk->GetEventCount() + 2 < evtCount / 16)
+		{
+			UINT32 len = 60 * (1 + GetRandom(8));
+			
+			note = (UINT8)(note + GetRandom(13) - 6);
+			if (note < 24 || note > 108)
+				note = 60;
+			AppendNoteOn(midTrk, notes, tick, chn, note, (UINT8)(40 + GetRandom(88)), len - GetRandom(30));
+			tick += len;
+		}
+		AppendNoteOffs(midTrk, notes, (UINT32)-1);
+		midTrk->AppendMetaEvent(0, 0x2F, 0, NULL);
+	}
+	
+	return;
+}
+
+static void Gen_Chords(MidiFile& midFile, UINT32 evtCount)
+{
+	UINT16 curTrk;
+	
+	for (curTrk = 0; curTrk < 4; curTrk ++)
+	{
+		MidiTrack* midTrk = midFile.NewTrack_Append();
+		std::vector<PendingNote> notes;
+		UINT8 chn = (UINT8)curTrk;
+		UINT32 tick = 0;
+		
+		PrepareTrack(midTrk, curTrk, chn, 0);
+		while(midTrk->GetEventCount() + 24 < evtCount / 4)
+		{
+			UINT32 noteCnt = 3 + GetRandom(10);
+			UINT8 baseNote = (UINT8)(36 + GetRandom(36));
+			UINT32 curNote;
+			
+			// notes of a chord overlap with the next chords
+			for (curNote = 0; curNote < noteCnt; curNote ++)
+				AppendNoteOn(midTrk, notes, tick, chn, (UINT8)(baseNote + curNote * 4 + GetRandom(3)),
+							(UINT8)(60 + GetRandom(60)), 120 * (1 + GetRandom(6)));
+			tick += 30 * (1 + GetRandom(8));
+		}
+		AppendNoteOffs(midTrk, notes, (UINT32)-1);
+		midTrk->AppendMetaEvent(0, 0x2F, 0, NULL);
+	}
+	
+	return;
+}
+
+static void Gen_Ctrls(MidiFile& midFile, UINT32 evtCount)
+{
+	static const UINT8 CTRL_IDS[4] = {0x01, 0x07, 0x0A, 0x0B};
+	UINT16 curTrk;
+	
+	for (curTrk = 0; curTrk < 8; curTrk ++)
+	{
+		MidiTrack* midTrk = midFile.NewTrack_Append();
+		std::vector<PendingNote> notes;
+		UINT8 chn = (UINT8)curTrk;
+		UINT32 tick = 0;
+		
+		PrepareTrack(midTrk, curTrk, chn, (UINT8)GetRandom(0x80));
+		while(midTrk->GetEventCount() + 8 < evtCount / 8)
+		{
+			UINT32 curEvt;
+			
+			if (! GetRandom(16))
+				AppendNoteOn(midTrk, notes, tick, chn, (UINT8)(48 + GetRandom(24)), 100, 240);
+			AppendNoteOffs(midTrk, notes, tick);
+			// a controller sweep and a pitch bend on every tick
+			for (curEvt = 0; curEvt < 1 + GetRandom(3); curEvt ++)
+				midTrk->AppendEvent(tick - midTrk->GetTickCount(), 0xB0 | chn, CTRL_IDS[GetRandom(4)], (UINT8)GetRandom(0x80));
+			midTrk->AppendEvent(tick - midTrk->GetTickCount(), 0xE0 | chn, (UINT8)GetRandom(0x80), (UINT8)GetRandom(0x80));
+			tick ++;
+		}
+		AppendNoteOffs(midTrk, notes, (UINT32)-1);
+		midTrk->AppendMetaEvent(0, 0x2F, 0, NULL);
+	}
+	
+	return;
+}
+
+static void Gen_SysEx(MidiFile& midFile, UINT32 evtCount)
+{
+	std::vector<UINT8> sxData;
+	UINT16 curTrk;
+	
+	for (curTrk = 0; curTrk < 2; curTrk ++)
+	{
+		MidiTrack* midTrk = midFile.NewTrack_Append();
+		std::vector<PendingNote> notes;
+		UINT8 chn = (UINT8)curTrk;
+		UINT32 tick = 0;
+		
+		PrepareTrack(midTrk, curTrk, chn, 0);
+		while(midTrk->GetEventCount() + 2 < evtCount / 2)
+		{
+			if (! GetRandom(64))
+			{
+				// SysEx with 256 bytes up to 64 KB of data
+				UINT32 sxLen = 0x100 << GetRandom(9);
+				UINT32 curPos;
+				
+				sxData.resize(sxLen);
+				sxData[0] = 0x41;	// Roland
+				for (curPos = 1; curPos < sxLen - 1; curPos ++)
+					sxData[curPos] = (UINT8)GetRandom(0x80);
+				sxData[sxLen - 1] = 0xF7;
+				AppendNoteOffs(midTrk, notes, tick);
+				midTrk->AppendSysEx(tick - midTrk->GetTickCount(), sxLen, &sxData[0]);
+			}
+			AppendNoteOn(midTrk, notes, tick, chn, (UINT8)(48 + GetRandom(24)), 100, 60);
+			tick += 60;
+		}
+		AppendNoteOffs(midTrk, notes, (UINT32)-1);
+		midTrk->AppendMetaEvent(0, 0x2F, 0, NULL);
+	}
+	
+	return;
+}
+
+static void Gen_Tracks(MidiFile& midFile, UINT32 evtCount)
+{
+	UINT16 curTrk;
+	
+	for (curTrk = 0; curTrk < 1024; curTrk ++)
+	{
+		MidiTrack* midTrk = midFile.NewTrack_Append();
+		std::vector<PendingNote> notes;
+		UINT8 chn = (UINT8)(curTrk & 0x0F);
+		UINT32 tick = GetRandom(1920);
+		
+		PrepareTrack(midTrk, curTrk, chn, (UINT8)GetRandom(0x80));
+		while(midTrk->GetEventCount() + 2 < evtCount / 1024)
+		{
+			AppendNoteOn(midTrk, notes, tick, chn, (UINT8)(36 + GetRandom(48)), 100, 120);
+			tick += 120 * (1 + GetRandom(4));
+		}
+		AppendNoteOffs(midTrk, notes, (UINT32)-1);
+		midTrk->AppendMetaEvent(0, 0x2F, 0, NULL);
+	}
+	
+	return;
+}
+
+static void BenchmarkFile(const CorpusFile& cFile)
+{
+	const BENCH_TEST* test;
+	
+	printf("\n%s: %u bytes, %u events\n", cFile.name.c_str(), (UINT32)cFile.data.size(), cFile.evtCount);
+	if (cFile.data.empty())
+	{
+		printf("    no data\n");
+		return;
+	}
+	for (test = BenchTests; test->name != NULL; test ++)
+	{
+		double bestTime;
+		UINT32 curRep;
+		
+		bestTime = 0.0;
+		for (curRep = 0; curRep < REPEAT_COUNT; curRep ++)
+		{
+			double time = test->func(cFile);
+			if (curRep == 0 || time < bestTime)
+				bestTime = time;
+		}
+		if (bestTime < 0.0)
+		{
+			printf("    %-16s failed\n", test->name);
+			continue;
+		}
+		printf("    %-16s %9.2f ms  %8.2f Mevt/s\n", test->name, bestTime * 1000.0,
+				bestTime > 0.0 ? cFile.evtCount / bestTime / 1000000.0 : 0.0);
+	}
+	// The peak is measured for the whole process, so this includes all files tested before.
+	printf("    Peak memory: %.1f MB\n", (INT64)GetPeakMemory() / 1048576.0);
+	
+	return;
+}
+
+static double Bench_Load(const CorpusFile& cFile)
+{
+	MidiFile midFile;
+	double startTime;
+	double endTime;
+	UINT8 retVal;
+	
+	startTime = GetStatsTime();
+	retVal = midFile.LoadFile((UINT32)cFile.data.size(), &cFile.data[0]);
+	endTime = GetStatsTime();
+	
+	return retVal ? -1.0 : (endTime - startTime);
+}
+
+static double Bench_LoadMapped(const CorpusFile& cFile)
+{
+	MidiFile midFile;
+	double startTime;
+	double endTime;
+	UINT8 retVal;
+	
+	if (cFile.path.empty())
+		return -1.0;
+	
+	startTime = GetStatsTime();
+	retVal = midFile.LoadFileMapped(cFile.path.c_str());
+	endTime = GetStatsTime();
+	
+	return retVal ? -1.0 : (endTime - startTime);
+}
+
+static double Bench_Save(const CorpusFile& cFile)
+{
+	MidiFile midFile;
+	double startTime;
+	double endTime;
+	UINT32 dataLen;
+	UINT8* data;
+	UINT8 retVal;
+	
+	if (midFile.LoadFile((UINT32)cFile.data.size(), &cFile.data[0]))
+		return -1.0;
+	
+	startTime = GetStatsTime();
+	retVal = midFile.SaveFile(&dataLen, &data);
+	endTime = GetStatsTime();
+	if (retVal)
+		return -1.0;
+	free(data);
+	
+	return endTime - startTime;
+}
+
+static double Bench_SaveCompact(const CorpusFile& cFile)
+{
+	MidiFile midFile;
+	double startTime;
+	double endTime;
+	UINT32 dataLen;
+	UINT8* data;
+	UINT8 retVal;
+	
+	if (midFile.LoadFile((UINT32)cFile.data.size(), &cFile.data[0]))
+		return -1.0;
+	midFile.SetCompactOutput(true);
+	
+	startTime = GetStatsTime();
+	retVal = midFile.SaveFile(&dataLen, &data);
+	endTime = GetStatsTime();
+	if (retVal)
+		return -1.0;
+	free(data);
+	
+	return endTime - startTime;
+}
+
+static double Bench_ReadEvents(const CorpusFile& cFile)
+{
+	MidiEvtReader midiIn;
+	MidiEvent evt;
+	double startTime;
+	double endTime;
+	UINT32 evtCount;
+	
+	startTime = GetStatsTime();
+	if (midiIn.OpenBuffer((UINT32)cFile.data.size(), &cFile.data[0]))
+		return -1.0;
+	evtCount = 0;
+	while(! midiIn.NextTrack())
+	{
+		while(! midiIn.ReadEvent(evt))
+			evtCount ++;
+	}
+	midiIn.Close();
+	endTime = GetStatsTime();
+	
+	return (evtCount == cFile.evtCount) ? (endTime - startTime) : -1.0;
+}
+
+static double Bench_Format0(const CorpusFile& cFile)
+{
+	MidiFile midFile;
+	double startTime;
+	double endTime;
+	UINT8 retVal;
+	
+	if (midFile.LoadFile((UINT32)cFile.data.size(), &cFile.data[0]))
+		return -1.0;
+	
+	startTime = GetStatsTime();
+	retVal = midFile.ConvertMidiFormat(0);
+	endTime = GetStatsTime();
+	
+	return retVal ? -1.0 : (endTime - startTime);
+}
+
+static double Bench_Resolution(const CorpusFile& cFile)
+{
+	MidiFile midFile;
+	double startTime;
+	double endTime;
+	UINT8 retVal;
+	
+	if (midFile.LoadFile((UINT32)cFile.data.size(), &cFile.data[0]))
+		return -1.0;
+	
+	startTime = GetStatsTime();
+	retVal = midFile.ConvertMidiResolution(midFile.GetMidiResolution() * 3 / 2);
+	endTime = GetStatsTime();
+	
+	return retVal ? -1.0 : (endTime - startTime);
+}
+
+static double Bench_TempoMap(const CorpusFile& cFile)
+{
+	MidiFile midFile;
+	MidiTempoMap tempoMap;
+	std::vector<UINT32> ticks;
+	std::vector<UINT64> usecs;
+	double startTime;
+	double endTime;
+	UINT16 curTrk;
+	
+	if (midFile.LoadFile((UINT32)cFile.data.size(), &cFile.data[0]))
+		return -1.0;
+	ticks.reserve(cFile.evtCount);
+	for (curTrk = 0; curTrk < midFile.GetTrackCount(); curTrk ++)
+	{
+		const MidiEvtList& evtList = midFile.GetTrack(curTrk)->GetEvents();
+		midevt_const_it evtIt;
+		
+		for (evtIt = evtList.begin(); evtIt != evtList.end(); ++evtIt)
+			ticks.push_back(evtIt->tick);
+	}
+	usecs.resize(ticks.size());
+	
+	startTime = GetStatsTime();
+	tempoMap.Build(midFile);
+	if (! ticks.empty())
+		tempoMap.Tick2Usec(ticks.size(), &ticks[0], &usecs[0]);
+	endTime = GetStatsTime();
+	
+	return endTime - startTime;
+}
+
+static double Bench_EventSort(const CorpusFile& cFile)
+{
+	MidiFile midFile;
+	double startTime;
+	double endTime;
+	
+	if (midFile.LoadFile((UINT32)cFile.data.size(), &cFile.data[0]))
+		return -1.0;
+	
+	startTime = GetStatsTime();
+	MidiEventSort(midFile, EVTSORT_NOTES | EVTSORT_CTRLS);
+	endTime = GetStatsTime();
+	
+	return endTime - startTime;
+}
+
+static double Bench_VolConv(const CorpusFile& cFile)
+{
+	MidiEvtReader midiIn;
+	MidiEvtWriter midiOut;
+	VOLCONV_OPTS opts;
+	double startTime;
+	double endTime;
+	UINT8 retVal;
+	
+	opts.evtMask = VOLEVT_ALL;
+	opts.chnMask = 0xFFFF;
+	opts.inAlgo = VOLALGO_GM;
+	opts.outAlgo = VOLALGO_FM;
+	opts.gain = -3.0;
+	
+	retVal = midiIn.OpenBuffer((UINT32)cFile.data.size(), &cFile.data[0]);
+	if (! retVal)
+		retVal = midiOut.OpenFile(TEMP_FILE_NAME, midiIn.GetMidiFormat(), midiIn.GetMidiResolution());
+	if (retVal)
+	{
+		midiIn.Close();
+		return -1.0;
+	}
+	
+	// Opening and closing the output file are not timed. (The writer still flushes its buffer
+	// while converting, but that goes to the OS file cache.)
+	startTime = GetStatsTime();
+	retVal = MidiVolConv(midiIn, midiOut, opts, NULL);
+	endTime = GetStatsTime();
+	midiOut.Close();
+	midiIn.Close();
+	remove(TEMP_FILE_NAME);
+	
+	return retVal ? -1.0 : (endTime - startTime);
+}
+
+static double Bench_Split(const CorpusFile& cFile, UINT8 spltMode)
+{
+	MidiFile midFile;
+	double startTime;
+	double endTime;
+	UINT8 retVal;
+	
+	if (midFile.LoadFile((UINT32)cFile.data.size(), &cFile.data[0]))
+		return -1.0;
+	
+	startTime = GetStatsTime();
+	retVal = SplitMidiTracks(midFile, spltMode, 0);
+	endTime = GetStatsTime();
+	
+	return retVal ? -1.0 : (endTime - startTime);
+}
+
+static double Bench_SplitChn(const CorpusFile& cFile)
+{
+	return Bench_Split(cFile, SPLT_BY_CHN);
+}
+
+static double Bench_SplitChord(const CorpusFile& cFile)
+{
+	return Bench_Split(cFile, SPLT_CHORD);
+}
+
+static double Bench_SplitIns(const CorpusFile& cFile)
+{
+	return Bench_Split(cFile, SPLT_BY_INS);
+}
+
+static double Bench_SplitVel(const CorpusFile& cFile)
+{
+	return Bench_Split(cFile, SPLT_BY_VEL);
+}
+
+static double Bench_SplitKey(const CorpusFile& cFile)
+{
+	return Bench_Split(cFile, SPLT_BY_KEY);
+}
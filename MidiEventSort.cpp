@@ -5,30 +5,25 @@
 #include <vector>
 #include <algorithm>
 #include <ctype.h>	// for tolower()
+#include <string.h>	// for strcmp()
 #include <math.h>
 
 #include <stdtype.h>
 #include "MidiLib.hpp"
-
-struct EvtSortInfo
-{
-	UINT32 sortID;
-	UINT32 order;
-	midevt_iterator evt;
-};
+#include "MidiBatch.hpp"
+#include "MidiStats.hpp"
+#include "MidiEventSortLib.hpp"
 
 
 // Function Prototypes
-void MidiEventSort(void);
-static void SortEvents(MidiTrack* midiTrk, midevt_iterator startIt, midevt_iterator endIt);
-static void ReorderEvents(MidiTrack* midiTrk, midevt_iterator startIt, midevt_iterator endIt, std::vector<EvtSortInfo> sortList);
-
+static UINT8 ProcessFile(const char* inFileName, const char* outFileName, FileStats* stats);
 
-#define EVTSORT_NOTES		0x01
-#define EVTSORT_CTRLS		0x02
 
 static UINT8 EVT_SORT_MASK;
-MidiFile CMidi;
+static bool COMPACT_OUTPUT;
+static bool BATCH_MODE;
+static UINT32 BATCH_THREADS;
+static UINT8 STATS_MODE;
 
 int main(int argc, char* argv[])
 {
@@ -39,10 +34,16 @@ int main(int argc, char* argv[])
 	if (argc < 3)
 	{
 		std::cout << "Usage: " << argv[0] << " [options] input.mid output.mid\n";
+		std::cout << "       " << argv[0] << " [options] -b input_dir/list.txt output_dir\n";
 		std::cout << "Options:\n";
 		std::cout << "    -e mask - bitmask of events to be sorted (default: 0x00)\n";
 		std::cout << "              0x01 - sort controllers by ID\n";
 		std::cout << "              0x02 - sort notes by pitch\n";
+		std::cout << "    -c      - compact output: use Running Status wherever possible\n";
+		std::cout << "    -b      - batch mode: process all files of a directory or list file\n";
+		std::cout << "    -j num  - number of threads for batch mode (default: one per CPU)\n";
+		std::cout << "    --stats - print statistics (time per phase, event counts, file sizes) to stderr\n";
+		std::cout << "              --stats=json prints one JSON object per file\n";
 #ifdef _DEBUG
 		getchar();
 #endif
@@ -51,11 +52,23 @@ int main(int argc, char* argv[])
 	
 	argbase = 1;
 	EVT_SORT_MASK = 0x00;
+	COMPACT_OUTPUT = false;
+	BATCH_MODE = false;
+	BATCH_THREADS = 0;
+	STATS_MODE = STATS_OFF;
 	while(argbase < argc && argv[argbase][0] == '-')
 	{
 		char optChr = tolower(argv[argbase][1]);
 		
-		if (optChr == 'e')
+		if (! strcmp(argv[argbase], "--stats"))
+		{
+			STATS_MODE = STATS_TEXT;
+		}
+		else if (! strcmp(argv[argbase], "--stats=json"))
+		{
+			STATS_MODE = STATS_JSON;
+		}
+		else if (optChr == 'e')
 		{
 			argbase ++;
 			if (argbase >= argc)
@@ -63,6 +76,22 @@ int main(int argc, char* argv[])
 			
 			EVT_SORT_MASK = (UINT8)strtol(argv[argbase], NULL, 0);
 		}
+		else if (optChr == 'c')
+		{
+			COMPACT_OUTPUT = true;
+		}
+		else if (optChr == 'b')
+		{
+			BATCH_MODE = true;
+		}
+		else if (optChr == 'j')
+		{
+			argbase ++;
+			if (argbase >= argc)
+				break;
+			
+			BATCH_THREADS = (UINT32)strtoul(argv[argbase], NULL, 0);
+		}
 		else
 		{
 			break;
@@ -77,28 +106,25 @@ int main(int argc, char* argv[])
 	
 	UINT8 retVal;
 	
-	std::cout << "Opening ...\n";
-	retVal = CMidi.LoadFile(argv[argbase + 0]);
-	if (retVal)
+	if (BATCH_MODE)
 	{
-		std::cout << "Error opening file!\n";
-		std::cout << "Errorcode: " << retVal;
-		return retVal;
+		UINT32 errCnt = RunBatch(argv[argbase + 0], argv[argbase + 1], BATCH_THREADS, &ProcessFile, STATS_MODE);
+		return errCnt ? 1 : 0;
 	}
 	
-	MidiEventSort();
+	FileStats stats;
 	
-	std::cout << "Saving ...\n";
-	retVal = CMidi.SaveFile(argv[argbase + 1]);
-	if (retVal)
+	ClearFileStats(&stats);
+	retVal = ProcessFile(argv[argbase + 0], argv[argbase + 1], (STATS_MODE != STATS_OFF) ? &stats : NULL);
+	EndFileStats(&stats);
+	if (STATS_MODE != STATS_OFF)
 	{
-		std::cout << "Error saving file!\n";
-		std::cout << "Errorcode: " << retVal;
-		return retVal;
+		std::cout << std::flush;
+		PrintFileStats(argv[argbase + 0], retVal, stats, STATS_MODE);
+		PrintStatsSummary(STATS_MODE);
 	}
-	
-	std::cout << "Cleaning ...\n";
-	CMidi.ClearAll();
+	if (retVal)
+		return retVal;
 	std::cout << "Done.\n";
 #ifdef _DEBUG
 	getchar();
@@ -107,157 +133,60 @@ int main(int argc, char* argv[])
 	return 0;
 }
 
-void MidiEventSort(void)
+// Note: Messages are printed in single-file mode only, as multiple files are processed at once in batch mode.
+static UINT8 ProcessFile(const char* inFileName, const char* outFileName, FileStats* stats)
 {
-	UINT16 trkCnt;
-	UINT16 curTrk;
-	
-	trkCnt = CMidi.GetTrackCount();
-	for (curTrk = 0; curTrk < trkCnt; curTrk ++)
-	{
-		MidiTrack* midiTrk = CMidi.GetTrack(curTrk);
-		midevt_iterator evtIt;
-		midevt_iterator tickStIt;
-		
-		tickStIt = midiTrk->GetEventBegin();
-		for (evtIt = midiTrk->GetEventBegin(); evtIt != midiTrk->GetEventEnd(); ++evtIt)
-		{
-			UINT8 evtChn = evtIt->evtType & 0x0F;
-			switch(evtIt->evtType & 0xF0)
-			{
-			case 0x80:
-			case 0x90:
-				break;
-			case 0xB0:
-				break;
-			}
-			if (evtIt->tick > tickStIt->tick)
-			{
-				SortEvents(midiTrk, tickStIt, evtIt);
-				tickStIt = evtIt;
-			}
-		}	// end while(evtIt)
-	}
-	
-	return;
-}
-
-static bool evtsort_compare(const EvtSortInfo& first, const EvtSortInfo& second)
-{
-	return (first.sortID < second.sortID);
-}
-
-static UINT32 GetEvtSortID(const MidiEvent& evt)
-{
-	UINT8 evtChn = evt.evtType & 0x0F;
-	UINT32 tmpID;
-	
-	switch(evt.evtType & 0xF0)
-	{
-	case 0x80:	// Note Off
-	case 0x90:	// Note On
-		tmpID = 0;
-		if (EVT_SORT_MASK & EVTSORT_NOTES)
-			tmpID |= (evt.evtValA << 4);
-		if ((evt.evtType & 0x10) && evt.evtValB > 0)	// Note On?
-			return 0xF000 | tmpID | (evtChn << 0);	// place last
-		else	// Note Off
-			return 0x0000 | tmpID | (evtChn << 0);	// place first
-	case 0xA0:
-		return 0x3000 | (evtChn << 8);
-	case 0xB0:
-		if (evt.evtValA >= 0x78)	// mode change
-			return (UINT32)-1;	// don't relocate
-		else if (evt.evtValA >= 0x60 && evt.evtValA <= 0x65)	// Data Increment/Decrement/NRPN/RPN
-			return (UINT32)-1;	// don't relocate
-		
-		if (evt.evtValA < 0x40)
-		{
-			UINT8 ctrlID = evt.evtValA & 0x1F;
-			UINT8 mlsb = (evt.evtValA & 0x20) >> 5;
-			if (ctrlID == 0x00)	// Bank Select
-				return 0x1000 | (evtChn << 8) | (mlsb << 0);	// place before Instrument Change
-			else if (ctrlID == 0x06)	// Data MSB/LSB
-				return (UINT32)-1;	// don't relocate
-			
-			tmpID = 0;
-			if (EVT_SORT_MASK & EVTSORT_CTRLS)
-				tmpID |= (ctrlID << 1) | (mlsb << 0);
-			return 0x2000 | (evtChn << 8) | tmpID;
-		}
-		return 0x2000 | (evtChn << 8) | (evt.evtValA << 0);
-	case 0xC0:
-		return 0x1002 | (evtChn << 8);
-	case 0xD0:
-		return 0x3001 | (evtChn << 8);
-	case 0xE0:
-		return 0x3002 | (evtChn << 8);
-	case 0xF0:
-		return (UINT32)-1;	// don't relocate
-	default:
-		return (UINT32)-1;	// don't relocate
-	}
-}
-
-static void SortEvents(MidiTrack* midiTrk, midevt_iterator startIt, midevt_iterator endIt)
-{
-	std::vector<EvtSortInfo> sortList;
-	midevt_iterator evtIt;
+	MidiFile midFile;
+	double startTime;
+	UINT8 retVal;
 	
-	for (evtIt = startIt; evtIt != endIt; ++evtIt)
+	if (! BATCH_MODE)
+		std::cout << "Opening ...\n";
+	startTime = GetStatsTime();
+	// SysEx/Meta data can stay in the mapped file, unless we overwrite it
+	if (! IsSameFile(inFileName, outFileName))
+		retVal = midFile.LoadFileMapped(inFileName);
+	else
+		retVal = midFile.LoadFile(inFileName);
+	EndStatsPhase(stats, STATPH_LOAD, startTime);
+	if (retVal)
 	{
-		EvtSortInfo esi;
-		esi.sortID = GetEvtSortID(*evtIt);
-		esi.evt = evtIt;
-		
-		if (esi.sortID == (UINT32)-1)
+		if (! BATCH_MODE)
 		{
-			if (sortList.size() >= 1)
-				ReorderEvents(midiTrk, sortList[0].evt, evtIt, sortList);
-			sortList.clear();
-		}
-		else
-		{
-			sortList.push_back(esi);
+			std::cout << "Error opening file!\n";
+			std::cout << "Errorcode: " << retVal;
 		}
+		return retVal;
 	}
-	if (sortList.size() > 1)
-		ReorderEvents(midiTrk, sortList[0].evt, evtIt, sortList);
+	if (stats != NULL)
+		stats->bytesRead = GetFileLength(inFileName);
+	CountFileEvents(stats, midFile);
 	
-	return;
-}
-
-static void ReorderEvents(MidiTrack* midiTrk, midevt_iterator startIt, midevt_iterator endIt, std::vector<EvtSortInfo> sortList)
-{
-	UINT32 curEvt;
-	for (curEvt = 0; curEvt < sortList.size(); curEvt ++)
-		sortList[curEvt].order = curEvt;
-	std::stable_sort(sortList.begin(), sortList.end(), evtsort_compare);
+	startTime = GetStatsTime();
+	MidiEventSort(midFile, EVT_SORT_MASK);
+	midFile.SetCompactOutput(COMPACT_OUTPUT);
+	EndStatsPhase(stats, STATPH_PROCESS, startTime);
 	
-	midevt_iterator evtIt = startIt;
-	for (curEvt = 0; curEvt < sortList.size(); curEvt ++)
+	if (! BATCH_MODE)
+		std::cout << "Saving ...\n";
+	startTime = GetStatsTime();
+	retVal = midFile.SaveFile(outFileName);
+	EndStatsPhase(stats, STATPH_SAVE, startTime);
+	if (retVal)
 	{
-		const EvtSortInfo& esi = sortList[curEvt];
-		// don't try to move events that are at the correct place already, prevents infinite loops
-		if (evtIt == esi.evt)
+		if (! BATCH_MODE)
 		{
-			++evtIt;
-			continue;
-		}
-		
-		MidiEvent evtData = *esi.evt;
-		midiTrk->RemoveEvent(esi.evt);
-		if (evtIt == midiTrk->GetEventBegin())
-		{
-			midiTrk->InsertEventT(evtData);
-		}
-		else
-		{
-			midevt_iterator prevEvt = evtIt;
-			--prevEvt;
-			midiTrk->InsertEventD(prevEvt, evtData);
+			std::cout << "Error saving file!\n";
+			std::cout << "Errorcode: " << retVal;
 		}
+		return retVal;
 	}
+	if (stats != NULL)
+		stats->bytesWritten = GetFileLength(outFileName);
+	
+	if (! BATCH_MODE)
+		std::cout << "Cleaning ...\n";
+	midFile.ClearAll();
 	
-	return;
+	return 0x00;
 }
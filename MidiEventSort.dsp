@@ -88,10 +88,22 @@ LINK32=link.exe
 # PROP Default_Filter "cpp;c;cxx;rc;def;r;odl;idl;hpj;bat"
 # Begin Source File
 
+SOURCE=.\MidiBatch.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\MidiLib.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\MidiStats.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\MidiEventSortLib.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\MidiEventSort.cpp
 # End Source File
 # End Group
@@ -100,8 +112,20 @@ SOURCE=.\MidiEventSort.cpp
 # PROP Default_Filter "h;hpp;hxx;hm;inl"
 # Begin Source File
 
+SOURCE=.\MidiBatch.hpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\MidiLib.hpp
 # End Source File
+# Begin Source File
+
+SOURCE=.\MidiStats.hpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\MidiEventSortLib.hpp
+# End Source File
 # End Group
 # Begin Group "Ressourcendateien"
 
@@ -0,0 +1,162 @@
+// Event sorting of the MIDI Event Sorter
+
+#include <vector>
+#include <algorithm>
+
+#include <stdtype.h>
+#include "MidiLib.hpp"
+#include "MidiEventSortLib.hpp"
+
+struct EvtSortInfo
+{
+	UINT32 sortID;
+	UINT32 order;
+	midevt_iterator evt;
+};
+
+
+// Function Prototypes
+static UINT32 GetEvtSortID(const MidiEvent& evt, UINT8 sortMask);
+static void SortEvents(MidiEditBatch& trkEdits, midevt_iterator startIt, midevt_iterator endIt, UINT8 sortMask);
+static void ReorderEvents(MidiEditBatch& trkEdits, midevt_iterator startIt, midevt_iterator endIt, std::vector<EvtSortInfo> sortList);
+
+
+void MidiEventSort(MidiFile& midFile, UINT8 sortMask)
+{
+	UINT16 trkCnt;
+	UINT16 curTrk;
+	
+	trkCnt = midFile.GetTrackCount();
+	for (curTrk = 0; curTrk < trkCnt; curTrk ++)
+	{
+		MidiTrack* midiTrk = midFile.GetTrack(curTrk);
+		MidiEditBatch trkEdits;	// all moves are applied together after scanning the track
+		midevt_iterator evtIt;
+		midevt_iterator tickStIt;
+		
+		tickStIt = midiTrk->GetEventBegin();
+		for (evtIt = midiTrk->GetEventBegin(); evtIt != midiTrk->GetEventEnd(); ++evtIt)
+		{
+			UINT8 evtChn = evtIt->evtType & 0x0F;
+			switch(evtIt->evtType & 0xF0)
+			{
+			case 0x80:
+			case 0x90:
+				break;
+			case 0xB0:
+				break;
+			}
+			if (evtIt->tick > tickStIt->tick)
+			{
+				SortEvents(trkEdits, tickStIt, evtIt, sortMask);
+				tickStIt = evtIt;
+			}
+		}	// end while(evtIt)
+		midiTrk->ApplyEdits(trkEdits);
+	}
+	
+	return;
+}
+
+static bool evtsort_compare(const EvtSortInfo& first, const EvtSortInfo& second)
+{
+	return (first.sortID < second.sortID);
+}
+
+static UINT32 GetEvtSortID(const MidiEvent& evt, UINT8 sortMask)
+{
+	UINT8 evtChn = evt.evtType & 0x0F;
+	UINT32 tmpID;
+	
+	switch(evt.evtType & 0xF0)
+	{
+	case 0x80:	// Note Off
+	case 0x90:	// Note On
+		tmpID = 0;
+		if (sortMask & EVTSORT_NOTES)
+			tmpID |= (evt.evtValA << 4);
+		if ((evt.evtType & 0x10) && evt.evtValB > 0)	// Note On?
+			return 0xF000 | tmpID | (evtChn << 0);	// place last
+		else	// Note Off
+			return 0x0000 | tmpID | (evtChn << 0);	// place first
+	case 0xA0:
+		return 0x3000 | (evtChn << 8);
+	case 0xB0:
+		if (evt.evtValA >= 0x78)	// mode change
+			return (UINT32)-1;	// don't relocate
+		else if (evt.evtValA >= 0x60 && evt.evtValA <= 0x65)	// Data Increment/Decrement/NRPN/RPN
+			return (UINT32)-1;	// don't relocate
+		
+		if (evt.evtValA < 0x40)
+		{
+			UINT8 ctrlID = evt.evtValA & 0x1F;
+			UINT8 mlsb = (evt.evtValA & 0x20) >> 5;
+			if (ctrlID == 0x00)	// Bank Select
+				return 0x1000 | (evtChn << 8) | (mlsb << 0);	// place before Instrument Change
+			else if (ctrlID == 0x06)	// Data MSB/LSB
+				return (UINT32)-1;	// don't relocate
+			
+			tmpID = 0;
+			if (sortMask & EVTSORT_CTRLS)
+				tmpID |= (ctrlID << 1) | (mlsb << 0);
+			return 0x2000 | (evtChn << 8) | tmpID;
+		}
+		return 0x2000 | (evtChn << 8) | (evt.evtValA << 0);
+	case 0xC0:
+		return 0x1002 | (evtChn << 8);
+	case 0xD0:
+		return 0x3001 | (evtChn << 8);
+	case 0xE0:
+		return 0x3002 | (evtChn << 8);
+	case 0xF0:
+		return (UINT32)-1;	// don't relocate
+	default:
+		return (UINT32)-1;	// don't relocate
+	}
+}
+
+static void SortEvents(MidiEditBatch& trkEdits, midevt_iterator startIt, midevt_iterator endIt, UINT8 sortMask)
+{
+	std::vector<EvtSortInfo> sortList;
+	midevt_iterator evtIt;
+	
+	for (evtIt = startIt; evtIt != endIt; ++evtIt)
+	{
+		EvtSortInfo esi;
+		esi.sortID = GetEvtSortID(*evtIt, sortMask);
+		esi.evt = evtIt;
+		
+		if (esi.sortID == (UINT32)-1)
+		{
+			if (sortList.size() >= 1)
+				ReorderEvents(trkEdits, sortList[0].evt, evtIt, sortList);
+			sortList.clear();
+		}
+		else
+		{
+			sortList.push_back(esi);
+		}
+	}
+	if (sortList.size() > 1)
+		ReorderEvents(trkEdits, sortList[0].evt, evtIt, sortList);
+	
+	return;
+}
+
+static void ReorderEvents(MidiEditBatch& trkEdits, midevt_iterator startIt, midevt_iterator endIt, std::vector<EvtSortInfo> sortList)
+{
+	UINT32 curEvt;
+	for (curEvt = 0; curEvt < sortList.size(); curEvt ++)
+		sortList[curEvt].order = curEvt;
+	std::stable_sort(sortList.begin(), sortList.end(), evtsort_compare);
+	
+	// skip events that are at the correct place already
+	midevt_iterator evtIt = startIt;
+	for (curEvt = 0; curEvt < sortList.size() && evtIt == sortList[curEvt].evt; curEvt ++)
+		++evtIt;
+	// move all remaining events to the end of the range, in sorted order
+	for (; curEvt < sortList.size(); curEvt ++)
+		trkEdits.Move(endIt, sortList[curEvt].evt);
+	
+	return;
+}
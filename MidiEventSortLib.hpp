@@ -0,0 +1,16 @@
+#ifndef __MIDIEVENTSORTLIB_HPP__
+#define __MIDIEVENTSORTLIB_HPP__
+
+#include <stdtype.h>
+
+class MidiFile;
+
+#define EVTSORT_NOTES		0x01
+#define EVTSORT_CTRLS		0x02
+
+// Sorts the events of each tick into a fixed order (e.g. Bank Select before Program Change,
+// Note Off before Note On). SysEx, Meta and RPN/NRPN events are never moved.
+// sortMask: EVTSORT_* flags, additionally sorts notes by key and controllers by number
+void MidiEventSort(MidiFile& midFile, UINT8 sortMask);
+
+#endif	// __MIDIEVENTSORTLIB_HPP__
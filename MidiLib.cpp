@@ -2,11 +2,22 @@
 
 #include <iostream>
 #include <fstream>
-#include <list>
 #include <vector>
 #include <algorithm>
+#include <new>	// for std::bad_alloc
+#include <stdlib.h>
 #include <string.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#endif
+
 #include <stdtype.h>
 #include "MidiLib.hpp"
 
@@ -14,795 +25,2911 @@
 #define FCC_MTHD	0x6468544D	// 'MThd'
 #define FCC_MTRK	0x6B72544D	// 'MTrk'
 
+#define ARENA_BLOCK_MIN	0x10000	// size of the first block of a MidiArena
+#define ARENA_BLOCK_MAX	0x100000
+#define ARENA_KEEP_MAX	0x40	// number of arenas that each thread keeps for the next file
+#define TICKIDX_STEP	0x40	// number of events between two tick index entries
+#define PARALLEL_MIN_SIZE	0x10000	// files smaller than this are processed by a single thread
+#define TRK_READ_BLOCK	0x100000	// MidiTrack::ReadFromFile reads the chunk in blocks of this size
 
-static UINT16 ReadBE16(FILE* infile);
-static UINT32 ReadBE32(FILE* infile);
-static UINT32 ReadMidiValue(FILE* infile);
-static void WriteBE16(FILE* outfile, UINT16 Value);
-static void WriteBE32(FILE* outfile, UINT32 Value);
-static void WriteMidiValue(FILE* outfile, UINT32 Value);
+#ifdef _MSC_VER
+#define THREAD_LOCAL	__declspec(thread)
+#else
+#define THREAD_LOCAL	__thread
+#endif
 
 
-// --- MidiTrack Class ---
-MidiTrack::MidiTrack(void)
+struct ParallelJob
+{
+	PARALLEL_FUNC func;
+	void* userData;
+	size_t count;
+	size_t next;	// next index to be processed
+	UINT32 allocCount;	// allocations done by the worker threads
+#ifdef _WIN32
+	CRITICAL_SECTION lock;
+#else
+	pthread_mutex_t lock;
+#endif
+};
+
+struct TrackWriteJob
+{
+	MidiTrack* const* tracks;
+	std::vector<UINT8>* chunks;
+	UINT8* retVals;
+	bool compact;
+};
+
+struct TrackReadJob
+{
+	const UINT8* fileData;
+	const UINT32* chunkPos;	// start of each "MTrk" chunk
+	const UINT32* chunkSize;
+	MidiTrack** tracks;
+	MidiArena** arenas;
+	UINT8* retVals;
+	bool refData;
+};
+
+// length of a variable-length value, indexed by the "continuation" bits of its first 4 bytes
+// (bit 3 = 1st byte, bit 0 = 4th byte), 5 = longer than 4 bytes
+static const UINT8 VLQ_LENGTH[0x10] =
+{
+	1, 1, 1, 1, 1, 1, 1, 1,	// 0xxx
+	2, 2, 2, 2,	// 10xx
+	3, 3,	// 110x
+	4,	// 1110
+	5,	// 1111
+};
+
+struct TrackMergeEntry
 {
+	UINT32 tick;	// tick of the track's next event
+	UINT16 trkID;
+};
+
+static THREAD_LOCAL bool inParallelJob = false;	// set while a thread works on a RunParallel() job
+static THREAD_LOCAL UINT32 allocCount = 0;	// see GetAllocCount()
+// arenas of cleared MidiFiles, reused by the next file that this thread loads
+static THREAD_LOCAL std::vector<MidiArena*>* arenaCache = NULL;
+
+
+static UINT16 ReadBE16(const UINT8* data);
+static UINT32 ReadBE32(const UINT8* data);
+static UINT32 ReadMidiValue(const UINT8* data, UINT32 dataLen, UINT32* curPos);
+static UINT8 ReadMidiEvent(const UINT8* data, UINT32 dataLen, UINT32* curPos, UINT32* curTick, UINT8* lastEvt, MidiEvent* evt, bool refData, MidiArena* arena, UINT32* evtPos);
+static UINT8* MapFileData(const char* fileName, UINT32* retSize, bool writable);
+static void UnmapFileData(UINT8* data, UINT32 size);
+static UINT32 GetCPUCount(void);
+static MidiArena* GetCachedArena(void);
+static void CacheArena(MidiArena* arena);
+static void FreeArenaCache(void);
+static void DoParallelJob(ParallelJob* job);
+static void ReadTrackFunc(void* userData, size_t index);
+static bool MergeEntryGreater(const TrackMergeEntry& a, const TrackMergeEntry& b);
+static UINT32 GetGCD(UINT32 a, UINT32 b);
+static void WriteTrackFunc(void* userData, size_t index);
+static UINT8 WriteChunks(FILE* outfile, const std::vector< std::vector<UINT8> >& chunks);
+static void WriteFCC(std::vector<UINT8>& buffer, UINT32 fcc);
+static void WriteBE16(std::vector<UINT8>& buffer, UINT16 Value);
+static void WriteBE32(std::vector<UINT8>& buffer, UINT32 Value);
+static void WriteBE16(UINT8* data, UINT16 Value);
+static void WriteBE32(UINT8* data, UINT32 Value);
+static void WriteMidiValue(std::vector<UINT8>& buffer, UINT32 Value);
+static void WriteMidiEvent(std::vector<UINT8>& buffer, const MidiEvent& evt, UINT32 delay, UINT8* lastEvt, bool compact);
+
+
+// --- MidiArena Class ---
+MidiArena::MidiArena(void)
+{
+	_nextSize = ARENA_BLOCK_MIN;
+	_curPtr = NULL;
+	_curFree = 0;
+	
 	return;
 }
 
-MidiTrack::~MidiTrack()
+MidiArena::~MidiArena()
 {
+	Reset();
+	if (! _blocks.empty())
+		free(_blocks[0].data);
+	
 	return;
 }
 
-UINT8 MidiTrack::ReadFromFile(FILE* infile)
+void* MidiArena::Alloc(size_t size)
 {
-	UINT32 TempLng;
-	UINT32 TrkPos;
-	UINT32 TrkEnd;
-	UINT8 LastEvt;
-	UINT8 CurEvt;
-	UINT8 EvtVal;
-	UINT32 CurTick;
-	
-	fread(&TempLng, 0x04, 1, infile);
-	if (TempLng != FCC_MTRK)
-		return 0x10;
-	
-	TempLng = ReadBE32(infile);	// Read Track Length
-	TrkPos = (UINT32)ftell(infile);
-	TrkEnd = TrkPos + TempLng;
-	
-	_events.clear();
-	//_events.reserve(TempLng / 4);
+	void* retPtr;
 	
-	LastEvt = 0x00;
-	CurTick = 0;
-	// read events
-	while(! feof(infile) && (UINT32)ftell(infile) < TrkEnd)
+	size = (size + 7) & ~(size_t)7;	// keep all allocations 8-byte aligned
+	if (size > _curFree)
 	{
-		MidiEvent* newEvt;
-		bool rsUse;
-		
-		CurTick += ReadMidiValue(infile);
-		if (feof(infile))
-			break;
+		Block newBlk;
 		
-		fread(&CurEvt, 0x01, 1, infile);
-		if (CurEvt < 0x80)
-		{
-			if (LastEvt < 0x80 || LastEvt >= 0xF0)
-				return 0x01;
-			EvtVal = CurEvt;
-			CurEvt = LastEvt;
-			rsUse = true;
-		}
-		else
+		if (size > ARENA_BLOCK_MAX / 4)
 		{
-			if (CurEvt < 0xF0)
+			// big SysEx data gets a separate allocation, so that no block space is wasted
+			retPtr = malloc(size);
+			if (retPtr != NULL)
 			{
-				LastEvt = CurEvt;
-				fread(&EvtVal, 0x01, 1, infile);
+				_bigAllocs.push_back((UINT8*)retPtr);
+				allocCount ++;
 			}
-			rsUse = false;
+			return retPtr;
 		}
 		
-		_events.push_back(MidiEvent());
-		newEvt = &_events.back();
-		
-		newEvt->tick = CurTick;
-		newEvt->rsUse = rsUse;
-		newEvt->evtType = CurEvt;
-		switch(CurEvt & 0xF0)
-		{
-		case 0x80:
-		case 0x90:
-		case 0xA0:
-		case 0xB0:
-		case 0xE0:
-			newEvt->evtValA = EvtVal;
-			fread(&newEvt->evtValB, 0x01, 1, infile);
-			break;
-		case 0xC0:
-		case 0xD0:
-			newEvt->evtValA = EvtVal;
-			newEvt->evtValB = 0x00;
-			break;
-		case 0xF0:
-			switch(CurEvt)
-			{
-			case 0xFF:
-				fread(&newEvt->evtValA, 0x01, 1, infile);
-				// fall through
-			case 0xF0:
-			case 0xF7:
-				newEvt->evtData.resize(ReadMidiValue(infile));
-				if (newEvt->evtData.size())
-					fread(&newEvt->evtData[0x00], 0x01, newEvt->evtData.size(), infile);
-				break;
-			}
-		}
+		newBlk.size = _nextSize;
+		newBlk.data = (UINT8*)malloc(newBlk.size);
+		if (newBlk.data == NULL)
+			return NULL;
+		allocCount ++;
+		_blocks.push_back(newBlk);
+		if (_nextSize < ARENA_BLOCK_MAX)
+			_nextSize *= 2;
+		_curPtr = newBlk.data;
+		_curFree = newBlk.size;
 	}
-	fseek(infile, TrkEnd, SEEK_SET);
 	
-	return 0x00;
+	retPtr = _curPtr;
+	_curPtr += size;
+	_curFree -= size;
+	
+	return retPtr;
 }
 
-UINT8 MidiTrack::WriteToFile(FILE* outfile) const
+void MidiArena::Reset(void)
 {
-	UINT32 TempLng;
-	UINT32 TrkPos;
-	UINT32 TrkEnd;
-	UINT8 LastEvt;
-	midevt_const_it evtIt;
-	UINT32 CurTick;
-	
-	TempLng = FCC_MTRK;
-	fwrite(&TempLng, 0x04, 1, outfile);
-	TempLng = 0x00000000;
-	fwrite(&TempLng, 0x04, 1, outfile);
-	
-	TrkPos = (UINT32)ftell(outfile);
-	
-	LastEvt = 0x00;
-	CurTick = 0;
-	// write events
-	for (evtIt = _events.begin(); evtIt != _events.end(); ++evtIt)
-	{
-		WriteMidiValue(outfile, evtIt->tick - CurTick);
-		CurTick = evtIt->tick;
-		
-		if (evtIt->evtType < 0xF0)
-		{
-			if (! evtIt->rsUse || LastEvt != evtIt->evtType)
-				fwrite(&evtIt->evtType, 0x01, 1, outfile);
-		}
-		switch(evtIt->evtType & 0xF0)
-		{
-		case 0x80:
-		case 0x90:
-		case 0xA0:
-		case 0xB0:
-		case 0xE0:
-			fwrite(&evtIt->evtValA, 0x01, 1, outfile);
-			fwrite(&evtIt->evtValB, 0x01, 1, outfile);
-			break;
-		case 0xC0:
-		case 0xD0:
-			fwrite(&evtIt->evtValA, 0x01, 1, outfile);
-			break;
-		case 0xF0:
-			fwrite(&evtIt->evtType, 0x01, 1, outfile);
-			switch(evtIt->evtType)
-			{
-			case 0xFF:
-				fwrite(&evtIt->evtValA, 0x01, 1, outfile);
-				// fall through
-			case 0xF0:
-			case 0xF7:
-				WriteMidiValue(outfile, evtIt->evtData.size());
-				if (evtIt->evtData.size() > 0)
-					fwrite(&evtIt->evtData[0x00], 0x01, evtIt->evtData.size(), outfile);
-				break;
-			}
-		}
-		LastEvt = evtIt->evtType;
-	}
-	TrkEnd = (UINT32)ftell(outfile);
+	size_t curBlk;
 	
-	fseek(outfile, TrkPos - 0x04, SEEK_SET);
-	WriteBE32(outfile, TrkEnd - TrkPos);
+	for (curBlk = 0; curBlk < _bigAllocs.size(); curBlk ++)
+		free(_bigAllocs[curBlk]);
+	_bigAllocs.clear();
 	
-	fseek(outfile, TrkEnd, SEEK_SET);
+	if (_blocks.empty())
+		return;
+	for (curBlk = 1; curBlk < _blocks.size(); curBlk ++)
+		free(_blocks[curBlk].data);
+	_blocks.resize(1);
+	_nextSize = _blocks[0].size * 2;
+	_curPtr = _blocks[0].data;
+	_curFree = _blocks[0].size;
 	
-	return 0x00;
+	return;
 }
 
-/*static*/ INT16 MidiTrack::GetPitchBendValue(UINT8 valLSB, UINT8 valMSB)
+
+// --- MidiEvtData Class ---
+MidiEvtData::MidiEvtData(const MidiEvtData& src) : _hdr(NULL)
 {
-	return	(((valMSB & 0x7F) << 7) |
-			((valLSB & 0x7F) << 0)) - 0x2000;
+	*this = src;
 }
 
-/*static*/ INT16 MidiTrack::GetPitchBendValue(const MidiEvent& evt)
+MidiEvtData::~MidiEvtData()
 {
-	if ((evt.evtType & 0xF0) != 0xE0)
-		return (INT16)0x8000;
-	else
-		return GetPitchBendValue(evt.evtValA, evt.evtValB);
+	FreeHdr(_hdr);
 }
 
-/*static*/ void MidiTrack::SetPitchBendValue(MidiEvent* evt, INT16 pbValue)
+/*static*/ MidiEvtData::DataHdr* MidiEvtData::AllocHdr(size_t dataSize, MidiArena* arena)
 {
-	if ((evt->evtType & 0xF0) != 0xE0)
-		return;
-	
-	if (pbValue < -0x2000)
-		pbValue = -0x2000;
-	else if (pbValue > 0x1FFF)
-		pbValue = 0x1FFF;
-	pbValue += 0x2000;
-	evt->evtValA = (pbValue >> 0) & 0x7F;
-	evt->evtValB = (pbValue >> 7) & 0x7F;
+	DataHdr* newHdr;
 	
-	return;
+	if (arena != NULL)
+	{
+		newHdr = (DataHdr*)arena->Alloc(sizeof(DataHdr) + dataSize);
+		if (newHdr != NULL)
+		{
+			newHdr->inArena = true;
+			return newHdr;
+		}
+	}
+	newHdr = (DataHdr*)malloc(sizeof(DataHdr) + dataSize);
+	if (newHdr == NULL)
+		return NULL;
+	allocCount ++;
+	newHdr->inArena = false;
+	return newHdr;
 }
 
-UINT32 MidiTrack::GetEventCount(void) const
+/*static*/ void MidiEvtData::FreeHdr(DataHdr* hdr)
 {
-	return _events.size();
+	if (hdr != NULL && ! hdr->inArena)
+		free(hdr);
+	
+	return;
 }
 
-UINT32 MidiTrack::GetTickCount(void) const
+MidiEvtData& MidiEvtData::operator=(const MidiEvtData& src)
 {
-	return _events.empty() ? 0 : _events.back().tick;
+	if (this == &src)
+		return *this;
+	
+	// Copies always get their own data, so that they don't depend on the source file or arena.
+	// (Only swap() passes references on.)
+	assign(src.begin(), src.end());
+	
+	return *this;
 }
 
-const MidiEvtList& MidiTrack::GetEvents(void) const
+UINT8* MidiEvtData::GetWritePtr(void)
 {
-	return _events;
+	if (IsRef())
+	{
+		// turn the reference into a private copy
+		Detach();
+		if (IsRef())
+			return NULL;	// out of memory
+	}
+	
+	return reinterpret_cast<UINT8*>(_hdr + 1);
 }
 
-midevt_iterator MidiTrack::GetEventBegin(void)
+void MidiEvtData::Detach(void)
 {
-	return _events.begin();
+	// move the data into a heap allocation that can be resized and freed
+	DataHdr* newHdr = AllocHdr(_hdr->size, NULL);
+	if (newHdr == NULL)
+		return;
+	newHdr->size = _hdr->size;
+	newHdr->ptr = reinterpret_cast<const UINT8*>(newHdr + 1);
+	memcpy(newHdr + 1, _hdr->ptr, newHdr->size);
+	FreeHdr(_hdr);
+	_hdr = newHdr;
+	
+	return;
 }
 
-midevt_iterator MidiTrack::GetEventEnd(void)
+void MidiEvtData::clear(void)
 {
-	return _events.end();
+	FreeHdr(_hdr);
+	_hdr = NULL;
+	
+	return;
 }
 
-midevt_iterator MidiTrack::GetEventFromTick(UINT32 tick)
+void MidiEvtData::resize(size_t newSize)
 {
-	midevt_iterator evtIt;
+	size_t oldSize = size();
+	DataHdr* newHdr;
 	
-	if (tick >= GetTickCount())
-		return _events.end();
+	if (! newSize)
+	{
+		clear();
+		return;
+	}
 	
-	for (evtIt = _events.begin(); evtIt != _events.end(); ++evtIt)
+	if (_hdr != NULL && (IsRef() || _hdr->inArena))
 	{
-		if (evtIt->tick >= tick)
-			return evtIt;
+		Detach();
+		if (IsRef() || _hdr->inArena)
+			return;	// out of memory
 	}
+	newHdr = (DataHdr*)realloc(_hdr, sizeof(DataHdr) + newSize);
+	if (newHdr == NULL)
+		return;
+	allocCount ++;
+	_hdr = newHdr;
+	_hdr->size = (UINT32)newSize;
+	_hdr->inArena = false;
+	_hdr->ptr = reinterpret_cast<const UINT8*>(_hdr + 1);
+	if (newSize > oldSize)
+		memset(reinterpret_cast<UINT8*>(_hdr + 1) + oldSize, 0x00, newSize - oldSize);
 	
-	return _events.end();
+	return;
 }
 
-/*static*/ MidiEvent MidiTrack::CreateEvent_Std(UINT8 Event, UINT8 Val1, UINT8 Val2)
+void MidiEvtData::assign(const UINT8* first, const UINT8* last, MidiArena* arena)
 {
-	MidiEvent newEvt;
+	size_t newSize = last - first;
+	DataHdr* newHdr;
 	
-	newEvt.tick = 0;
-	newEvt.rsUse = false;
-	newEvt.evtType = Event;
-	newEvt.evtValA = Val1;
-	newEvt.evtValB = Val2;
-	newEvt.evtData.clear();
+	if (size() == newSize && ! is_ref())
+	{
+		if (newSize)
+			memmove(_hdr + 1, first, newSize);
+		return;
+	}
 	
-	return newEvt;
+	newHdr = NULL;
+	if (newSize)
+	{
+		newHdr = AllocHdr(newSize, arena);
+		if (newHdr == NULL)
+			return;
+		newHdr->size = (UINT32)newSize;
+		newHdr->ptr = reinterpret_cast<const UINT8*>(newHdr + 1);
+		memcpy(newHdr + 1, first, newSize);
+	}
+	FreeHdr(_hdr);
+	_hdr = newHdr;
+	
+	return;
 }
 
-/*static*/ MidiEvent MidiTrack::CreateEvent_SysEx(UINT32 DataLen, const void* Data)
+void MidiEvtData::assign_ref(const UINT8* first, const UINT8* last, MidiArena* arena)
 {
-	MidiEvent newEvt;
+	DataHdr* newHdr;
 	
-	newEvt.tick = 0;
-	newEvt.rsUse = false;
-	newEvt.evtType = 0xF0;
-	newEvt.evtValA = 0x00;
-	newEvt.evtValB = 0x00;
-	newEvt.evtData.resize(DataLen);
-	if (DataLen)
-		memcpy(&newEvt.evtData[0x00], Data, DataLen);
+	newHdr = NULL;
+	if (last > first)
+	{
+		newHdr = AllocHdr(0, arena);
+		if (newHdr == NULL)
+			return;
+		newHdr->size = (UINT32)(last - first);
+		newHdr->ptr = first;
+	}
+	FreeHdr(_hdr);
+	_hdr = newHdr;
 	
-	return newEvt;
+	return;
 }
 
-/*static*/ MidiEvent MidiTrack::CreateEvent_Meta(UINT8 Type, UINT32 DataLen, const void* Data)
+void MidiEvtData::swap(MidiEvtData& other)
 {
-	MidiEvent newEvt;
-	
-	newEvt.tick = 0;
-	newEvt.rsUse = false;
-	newEvt.evtType = 0xFF;
-	newEvt.evtValA = Type;
-	newEvt.evtValB = 0x00;
-	newEvt.evtData.resize(DataLen);
-	if (DataLen)
-		memcpy(&newEvt.evtData[0x00], Data, DataLen);
+	DataHdr* tempHdr = _hdr;
+	_hdr = other._hdr;
+	other._hdr = tempHdr;
 	
-	return newEvt;
+	return;
 }
 
-void MidiTrack::AppendEvent(const MidiEvent& Event)
+
+// --- MidiEvtList Class ---
+MidiEvtList::MidiEvtList(void)
 {
-	if (Event.tick < GetTickCount())
-		return;
-	
-	_events.push_back(Event);
+	_nodes.resize(1);
+	_nodes[0].prev = 0;
+	_nodes[0].next = 0;
+	_freeNode = 0;
+	_count = 0;
 	
 	return;
 }
 
-void MidiTrack::AppendEvent(UINT32 Delay, MidiEvent Event)
+void MidiEvtList::reserve(size_t count)
 {
-	Event.tick = GetTickCount() + Delay;
-	AppendEvent(Event);
+	GrowPool(1 + count);
 	
 	return;
 }
 
-void MidiTrack::AppendEvent(UINT32 Delay, UINT8 Event, UINT8 Val1, UINT8 Val2)
+void MidiEvtList::clear(void)
 {
-	AppendEvent(Delay, CreateEvent_Std(Event, Val1, Val2));
+	_nodes.resize(1);
+	_nodes[0].prev = 0;
+	_nodes[0].next = 0;
+	_freeNode = 0;
+	_count = 0;
+	_tickIdx.clear();
 	
 	return;
 }
 
-void MidiTrack::AppendSysEx(UINT32 Delay, UINT32 DataLen, const void* Data)
+UINT32 MidiEvtList::AllocNode(MidiEvent& evt, bool move)
 {
-	AppendEvent(Delay, CreateEvent_SysEx(DataLen, Data));
+	UINT32 node;
 	
-	return;
+	if (! move)
+		return AllocNode(evt);
+	
+	if (_freeNode)
+	{
+		node = _freeNode;
+		_freeNode = _nodes[node].next;
+	}
+	else
+	{
+		node = (UINT32)_nodes.size();
+		GrowPool(node + 1);
+		_nodes.push_back(EvtNode());
+	}
+	MoveNodeEvent(_nodes[node].evt, evt);
+	_count ++;
+	
+	return node;
 }
 
-void MidiTrack::AppendMetaEvent(UINT32 Delay, UINT8 Type, UINT32 DataLen, const void* Data)
+UINT32 MidiEvtList::AllocNode(const MidiEvent& evt)
 {
-	AppendEvent(Delay, CreateEvent_Meta(Type, DataLen, Data));
+	UINT32 node;
 	
-	return;
+	if (_freeNode)
+	{
+		// reuse the slot of a removed event
+		node = _freeNode;
+		_freeNode = _nodes[node].next;
+		_nodes[node].evt = evt;
+	}
+	else
+	{
+		// Note: evt may be part of this list, so it must be copied before the pool grows.
+		MidiEvent newEvt = evt;
+		node = (UINT32)_nodes.size();
+		GrowPool(node + 1);
+		_nodes.push_back(EvtNode());
+		MoveNodeEvent(_nodes[node].evt, newEvt);
+	}
+	_count ++;
+	
+	return node;
 }
 
-
-void MidiTrack::InsertEventT(const MidiEvent& Event)
+void MidiEvtList::GrowPool(size_t minCount)
 {
-	midevt_iterator evtIt;
+	std::vector<EvtNode> newNodes;
+	size_t newSize;
+	size_t node;
 	
-	evtIt = GetFirstEventAtTick(Event.tick);
-	_events.insert(evtIt, Event);
+	if (_nodes.capacity() >= minCount)
+		return;
+	
+	// std::vector would relocate the nodes by copying them, which duplicates all SysEx/Meta data.
+	// So the pool is grown by hand and the event data is swapped into the new nodes.
+	newSize = _nodes.capacity() * 2;
+	if (newSize < minCount)
+		newSize = minCount;
+	newNodes.reserve(newSize);
+	allocCount ++;
+	newNodes.resize(_nodes.size());
+	for (node = 0; node < _nodes.size(); node ++)
+	{
+		newNodes[node].prev = _nodes[node].prev;
+		newNodes[node].next = _nodes[node].next;
+		MoveNodeEvent(newNodes[node].evt, _nodes[node].evt);
+	}
+	_nodes.swap(newNodes);
 	
 	return;
 }
 
-void MidiTrack::InsertEventT(UINT32 tick, MidiEvent Event)
+void MidiEvtList::FreeNode(UINT32 node)
 {
-	Event.tick = tick;
-	InsertEventT(Event);
+	_nodes[node].evt.evtData.clear();	// release payload memory
+	_nodes[node].prev = 0;
+	_nodes[node].next = _freeNode;
+	_freeNode = node;
+	_count --;
 	
 	return;
 }
 
-void MidiTrack::InsertEventT(UINT32 tick, UINT8 Event, UINT8 Val1, UINT8 Val2)
+void MidiEvtList::LinkNode(UINT32 node, UINT32 nextNode)
 {
-	InsertEventT(tick, CreateEvent_Std(Event, Val1, Val2));
+	UINT32 prevNode = _nodes[nextNode].prev;
+	
+	_nodes[node].prev = prevNode;
+	_nodes[node].next = nextNode;
+	_nodes[prevNode].next = node;
+	_nodes[nextNode].prev = node;
 	
 	return;
 }
 
-void MidiTrack::InsertSysExT(UINT32 tick, UINT32 DataLen, const void* Data)
+void MidiEvtList::UnlinkNode(UINT32 node)
 {
-	InsertEventT(tick, CreateEvent_SysEx(DataLen, Data));
+	UINT32 prevNode = _nodes[node].prev;
+	UINT32 nextNode = _nodes[node].next;
+	
+	_nodes[prevNode].next = nextNode;
+	_nodes[nextNode].prev = prevNode;
 	
 	return;
 }
 
-void MidiTrack::InsertMetaEventT(UINT32 tick, UINT8 Type, UINT32 DataLen, const void* Data)
+void MidiEvtList::push_back(const MidiEvent& evt)
 {
-	InsertEventT(tick, CreateEvent_Meta(Type, DataLen, Data));
+	LinkNode(AllocNode(evt), 0);
 	
 	return;
 }
 
-
-
-// insert with previous event and delay
-void MidiTrack::InsertEventD(midevt_iterator prevEvt, const MidiEvent& Event)
+void MidiEvtList::push_front(const MidiEvent& evt)
 {
-	if (prevEvt == _events.end())
-	{
-		if (Event.tick >= GetTickCount())
-			AppendEvent(Event);
-		else if (! Event.tick)
-			_events.insert(_events.begin(), Event);
-		return;
-	}
-	if (Event.tick < prevEvt->tick)
-		return;
-	
-	midevt_iterator nextEvt(prevEvt);
-	++nextEvt;
-	if (nextEvt != _events.end() && Event.tick > nextEvt->tick)
-		return;
-	
-	_events.insert(nextEvt, Event);
+	LinkNode(AllocNode(evt), _nodes[0].next);
 	
 	return;
 }
 
-void MidiTrack::InsertEventD(midevt_iterator prevEvt, UINT32 Delay, MidiEvent Event)
+MidiEvtList::iterator MidiEvtList::insert(iterator pos, const MidiEvent& evt)
 {
-	if (prevEvt == _events.end() && Delay)
-	{
-		InsertEventT(Delay, Event);
-		return;
-	}
+	UINT32 node = AllocNode(evt);
 	
-	if (prevEvt == _events.end())
-		Event.tick = 0;
-	else
-		Event.tick = prevEvt->tick + Delay;
-	InsertEventD(prevEvt, Event);
+	LinkNode(node, pos._node);
 	
-	return;
+	return iterator(this, node);
 }
 
-void MidiTrack::InsertEventD(midevt_iterator prevEvt, UINT32 Delay, UINT8 Event, UINT8 Val1, UINT8 Val2)
+MidiEvtList::iterator MidiEvtList::insert_move(iterator pos, MidiEvent& evt)
 {
-	InsertEventD(prevEvt, Delay, CreateEvent_Std(Event, Val1, Val2));
+	UINT32 node = AllocNode(evt, true);
 	
-	return;
+	LinkNode(node, pos._node);
+	
+	return iterator(this, node);
 }
 
-void MidiTrack::InsertSysExD(midevt_iterator prevEvt, UINT32 Delay, UINT32 DataLen, const void* Data)
+MidiEvtList::iterator MidiEvtList::splice(iterator pos, MidiEvtList& src, iterator srcIt)
 {
-	InsertEventD(prevEvt, Delay, CreateEvent_SysEx(DataLen, Data));
+	UINT32 node;
 	
-	return;
-}
+	if (&src != this)
+	{
+		node = AllocNode(src._nodes[srcIt._node].evt, true);
+		LinkNode(node, pos._node);
+		src.erase(srcIt);
+		return iterator(this, node);
+	}
+	
+	// same list: just relink the node
+	node = srcIt._node;
+	if (node == pos._node)
+		return srcIt;
+	if (! _tickIdx.empty())
+		RemoveTickIdxNode(node);
+	UnlinkNode(node);
+	LinkNode(node, pos._node);
+	
+	return iterator(this, node);
+}
+
+MidiEvtList::iterator MidiEvtList::erase(iterator pos)
+{
+	UINT32 nextNode = _nodes[pos._node].next;
+	
+	if (! _tickIdx.empty())
+		RemoveTickIdxNode(pos._node);
+	UnlinkNode(pos._node);
+	FreeNode(pos._node);
+	
+	return iterator(this, nextNode);
+}
+
+void MidiEvtList::RemoveTickIdxNode(UINT32 node)
+{
+	UINT32 tick = _nodes[node].evt.tick;
+	size_t idxL;
+	size_t idxH;
+	
+	// find the first index entry with (tick >= node's tick)
+	idxL = 0;
+	idxH = _tickIdx.size();
+	while(idxL < idxH)
+	{
+		size_t idxM = (idxL + idxH) / 2;
+		if (_nodes[_tickIdx[idxM]].evt.tick < tick)
+			idxL = idxM + 1;
+		else
+			idxH = idxM;
+	}
+	for (; idxL < _tickIdx.size() && _nodes[_tickIdx[idxL]].evt.tick == tick; idxL ++)
+	{
+		if (_tickIdx[idxL] != node)
+			continue;
+		
+		// move the entry to the following event or remove it
+		UINT32 nextNode = _nodes[node].next;
+		if (nextNode != 0 && (idxL + 1 >= _tickIdx.size() || _tickIdx[idxL + 1] != nextNode))
+			_tickIdx[idxL] = nextNode;
+		else
+			_tickIdx.erase(_tickIdx.begin() + idxL);
+		break;
+	}
+	
+	return;
+}
+
+void MidiEvtList::apply_edits(MidiEditBatch& edits)
+{
+	std::vector<UINT32> nodeOrder(_nodes.size());	// position of each node in the list
+	std::vector<bool> nodeDrop(_nodes.size(), false);
+	std::vector< std::pair<UINT32, size_t> > placeOrder;	// (position, place ID)
+	std::vector<EvtNode> newNodes;
+	UINT32 node;
+	UINT32 curPos;
+	size_t curPlc;
+	
+	curPos = 0;
+	for (node = _nodes[0].next; node != 0; node = _nodes[node].next, curPos ++)
+		nodeOrder[node] = curPos;
+	nodeOrder[0] = curPos;	// end() is placed after all other events
+	
+	placeOrder.resize(edits._places.size());
+	for (curPlc = 0; curPlc < edits._places.size(); curPlc ++)
+	{
+		const MidiEditBatch::EditPlace& ep = edits._places[curPlc];
+		placeOrder[curPlc] = std::make_pair(nodeOrder[ep.pos._node], curPlc);
+		if (ep.newEvt == (size_t)-1)
+			nodeDrop[ep.evt._node] = true;
+	}
+	for (curPlc = 0; curPlc < edits._removed.size(); curPlc ++)
+		nodeDrop[edits._removed[curPlc]._node] = true;
+	std::sort(placeOrder.begin(), placeOrder.end());
+	
+	// merge the old list with the placed events into a new pool
+	// The event data is swapped instead of copied, so that nothing is reallocated.
+	newNodes.reserve(1 + _count + placeOrder.size());
+	allocCount ++;
+	newNodes.resize(1);
+	curPlc = 0;
+	node = _nodes[0].next;
+	while(true)
+	{
+		curPos = nodeOrder[node];
+		for (; curPlc < placeOrder.size() && placeOrder[curPlc].first == curPos; curPlc ++)
+		{
+			MidiEditBatch::EditPlace& ep = edits._places[placeOrder[curPlc].second];
+			MidiEvent& evt = (ep.newEvt == (size_t)-1) ? _nodes[ep.evt._node].evt : edits._newEvts[ep.newEvt];
+			
+			newNodes.push_back(EvtNode());
+			MoveNodeEvent(newNodes.back().evt, evt);
+		}
+		if (node == 0)
+			break;
+		
+		if (! nodeDrop[node])
+		{
+			newNodes.push_back(EvtNode());
+			MoveNodeEvent(newNodes.back().evt, _nodes[node].evt);
+		}
+		node = _nodes[node].next;
+	}
+	
+	for (node = 0; node < newNodes.size(); node ++)
+	{
+		newNodes[node].prev = node - 1;
+		newNodes[node].next = node + 1;
+	}
+	newNodes[0].prev = (UINT32)newNodes.size() - 1;
+	newNodes.back().next = 0;
+	
+	_nodes.swap(newNodes);
+	_freeNode = 0;
+	_count = (UINT32)_nodes.size() - 1;
+	_tickIdx.clear();
+	
+	return;
+}
+
+void MidiEvtList::scale_ticks(UINT32 mul, UINT32 div)
+{
+	// Absolute ticks are scaled (not delays), so rounding errors don't add up.
+	// The rescaling is monotonic, so the order of events and the tick index stay valid.
+	// Unused nodes are scaled as well, as a linear pass over the pool is faster than following the links.
+	UINT64 halfDiv = div / 2;
+	size_t curNode;
+	
+	for (curNode = 1; curNode < _nodes.size(); curNode ++)
+	{
+		UINT32& tick = _nodes[curNode].evt.tick;
+		tick = (UINT32)(((UINT64)tick * mul + halfDiv) / div);
+	}
+	
+	return;
+}
+
+void MidiEvtList::ticks_changed(void)
+{
+	_tickIdx.clear();
+	
+	return;
+}
+
+/*static*/ void MidiEvtList::MoveNodeEvent(MidiEvent& dst, MidiEvent& src)
+{
+	dst.tick = src.tick;
+	dst.evtType = src.evtType;
+	dst.evtValA = src.evtValA;
+	dst.evtValB = src.evtValB;
+	dst.rsUse = src.rsUse;
+	dst.evtData.swap(src.evtData);
+	
+	return;
+}
+
+MidiEvtList::iterator MidiEvtList::lower_bound(UINT32 tick)
+{
+	size_t idxL;
+	size_t idxH;
+	UINT32 node;
+	UINT32 endNode;
+	UINT32 walkCnt;
+	std::vector<UINT32> newIdx;
+	
+	// find the last index entry with (tick < search tick)
+	idxL = 0;
+	idxH = _tickIdx.size();
+	while(idxL < idxH)
+	{
+		size_t idxM = (idxL + idxH) / 2;
+		if (_nodes[_tickIdx[idxM]].evt.tick < tick)
+			idxL = idxM + 1;
+		else
+			idxH = idxM;
+	}
+	// The result is between that entry and the next one.
+	node = idxL ? _tickIdx[idxL - 1] : _nodes[0].next;
+	endNode = (idxL < _tickIdx.size()) ? _tickIdx[idxL] : 0;
+	
+	walkCnt = 0;
+	while(node != endNode && _nodes[node].evt.tick < tick)
+	{
+		node = _nodes[node].next;
+		walkCnt ++;
+		// add index entries for long walks, so that the next search is faster
+		if (! (walkCnt % TICKIDX_STEP) && node != endNode)
+			newIdx.push_back(node);
+	}
+	if (! newIdx.empty())
+		_tickIdx.insert(_tickIdx.begin() + idxL, newIdx.begin(), newIdx.end());
+	
+	return iterator(this, node);
+}
+
+
+// --- MidiEditBatch Class ---
+void MidiEditBatch::Insert(midevt_iterator pos, const MidiEvent& evt)
+{
+	EditPlace ep;
+	
+	ep.pos = pos;
+	ep.newEvt = _newEvts.size();
+	_newEvts.push_back(evt);
+	_places.push_back(ep);
+	
+	return;
+}
+
+void MidiEditBatch::Move(midevt_iterator pos, midevt_iterator evtIt)
+{
+	EditPlace ep;
+	
+	ep.pos = pos;
+	ep.evt = evtIt;
+	ep.newEvt = (size_t)-1;
+	_places.push_back(ep);
+	
+	return;
+}
+
+void MidiEditBatch::Remove(midevt_iterator evtIt)
+{
+	_removed.push_back(evtIt);
+	
+	return;
+}
+
+void MidiEditBatch::Clear(void)
+{
+	_places.clear();
+	_removed.clear();
+	_newEvts.clear();
+	
+	return;
+}
+
+bool MidiEditBatch::IsEmpty(void) const
+{
+	return _places.empty() && _removed.empty();
+}
+
+
+// --- MidiTrack Class ---
+MidiTrack::MidiTrack(void)
+{
+	return;
+}
+
+MidiTrack::~MidiTrack()
+{
+	return;
+}
+
+UINT8 MidiTrack::ReadFromFile(FILE* infile)
+{
+	UINT8 TrkHdr[0x08];
+	UINT32 TempLng;
+	UINT32 TrkLen;
+	UINT32 ReadLen;
+	std::vector<UINT8> TrkData;
+	
+	if (fread(TrkHdr, 0x01, 0x08, infile) < 0x08)
+		return 0x10;
+	memcpy(&TempLng, &TrkHdr[0x00], 0x04);
+	if (TempLng != FCC_MTRK)
+		return 0x10;
+	
+	// read the whole chunk and parse it from memory
+	// It is read in blocks, so that a bogus chunk length can't allocate more memory than the file has.
+	TrkLen = ReadBE32(&TrkHdr[0x04]);
+	if (TrkLen > 0xFFFFFFFF - 0x08)
+		TrkLen = 0xFFFFFFFF - 0x08;
+	TrkData.resize(0x08);
+	memcpy(&TrkData[0x00], TrkHdr, 0x08);
+	ReadLen = 0;
+	while(ReadLen < TrkLen)
+	{
+		UINT32 BlkLen = TrkLen - ReadLen;
+		UINT32 BlkRead;
+		
+		if (BlkLen > TRK_READ_BLOCK)
+			BlkLen = TRK_READ_BLOCK;
+		TrkData.resize(0x08 + ReadLen + BlkLen);
+		BlkRead = (UINT32)fread(&TrkData[0x08 + ReadLen], 0x01, BlkLen, infile);
+		ReadLen += BlkRead;
+		if (BlkRead < BlkLen)
+			break;	// truncated chunk
+	}
+	TrkData.resize(0x08 + ReadLen);
+	
+	return ReadFromBuffer(TrkData.size(), &TrkData[0x00], NULL, false);
+}
+
+UINT8 MidiTrack::ReadFromBuffer(UINT32 BufLen, const UINT8* BufData, UINT32* RetChunkSize, bool refData, MidiArena* arena)
+{
+	UINT32 TempLng;
+	UINT32 CurPos;
+	UINT32 TrkEnd;
+	UINT8 LastEvt;
+	UINT32 CurTick;
+	UINT8 RetVal;
+	
+	if (BufLen < 0x08)
+		return 0x10;
+	memcpy(&TempLng, &BufData[0x00], 0x04);
+	if (TempLng != FCC_MTRK)
+		return 0x10;
+	
+	TempLng = ReadBE32(&BufData[0x04]);	// Read Track Length
+	CurPos = 0x08;
+	TrkEnd = CurPos + TempLng;
+	if (TrkEnd > BufLen || TrkEnd < CurPos)
+		TrkEnd = BufLen;	// truncated chunk - read as much as possible
+	if (RetChunkSize != NULL)
+		*RetChunkSize = TrkEnd;
+	
+	_events.clear();
+	try
+	{
+		// 3 bytes = smallest usual event (delay + 2 data bytes with Running Status)
+		// The size is based on the available data, as the chunk header may claim a lot more.
+		_events.reserve((TrkEnd - CurPos) / 3);
+		
+		LastEvt = 0x00;
+		CurTick = 0;
+		// read events
+		while(CurPos < TrkEnd)
+		{
+			_events.push_back(MidiEvent());
+			RetVal = ReadMidiEvent(BufData, TrkEnd, &CurPos, &CurTick, &LastEvt, &_events.back(), refData, arena, NULL);
+			if (RetVal)
+			{
+				_events.erase(--_events.end());
+				if (RetVal == 0xFF)
+					break;	// truncated event at the end of the chunk
+				return RetVal;
+			}
+		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		_events.clear();
+		return 0xFF;	// out of memory
+	}
+	
+	return 0x00;
+}
+
+UINT8 MidiTrack::WriteToFile(FILE* outfile, bool compact) const
+{
+	std::vector<UINT8> TrkData;
+	UINT8 RetVal;
+	
+	RetVal = WriteToBuffer(TrkData, compact);
+	if (RetVal)
+		return RetVal;
+	
+	if (fwrite(&TrkData[0x00], 0x01, TrkData.size(), outfile) < TrkData.size())
+		return 0xFF;
+	
+	return 0x00;
+}
+
+UINT8 MidiTrack::WriteToBuffer(std::vector<UINT8>& Buffer, bool compact) const
+{
+	size_t TrkPos;
+	UINT8 LastEvt;
+	midevt_const_it evtIt;
+	UINT32 CurTick;
+	
+	// guess the size (most events are 3-byte channel events with a short delay)
+	Buffer.reserve(Buffer.size() + 0x08 + _events.size() * 4);
+	
+	WriteFCC(Buffer, FCC_MTRK);
+	WriteBE32(Buffer, 0x00000000);	// length is written after the events
+	
+	TrkPos = Buffer.size();
+	
+	LastEvt = 0x00;
+	CurTick = 0;
+	// write events
+	for (evtIt = _events.begin(); evtIt != _events.end(); ++evtIt)
+	{
+		WriteMidiEvent(Buffer, *evtIt, evtIt->tick - CurTick, &LastEvt, compact);
+		CurTick = evtIt->tick;
+	}
+	
+	WriteBE32(&Buffer[TrkPos - 0x04], (UINT32)(Buffer.size() - TrkPos));
+	
+	return 0x00;
+}
+
+/*static*/ INT16 MidiTrack::GetPitchBendValue(UINT8 valLSB, UINT8 valMSB)
+{
+	return	(((valMSB & 0x7F) << 7) |
+			((valLSB & 0x7F) << 0)) - 0x2000;
+}
+
+/*static*/ INT16 MidiTrack::GetPitchBendValue(const MidiEvent& evt)
+{
+	if ((evt.evtType & 0xF0) != 0xE0)
+		return (INT16)0x8000;
+	else
+		return GetPitchBendValue(evt.evtValA, evt.evtValB);
+}
+
+/*static*/ void MidiTrack::SetPitchBendValue(MidiEvent* evt, INT16 pbValue)
+{
+	if ((evt->evtType & 0xF0) != 0xE0)
+		return;
+	
+	if (pbValue < -0x2000)
+		pbValue = -0x2000;
+	else if (pbValue > 0x1FFF)
+		pbValue = 0x1FFF;
+	pbValue += 0x2000;
+	evt->evtValA = (pbValue >> 0) & 0x7F;
+	evt->evtValB = (pbValue >> 7) & 0x7F;
+	
+	return;
+}
+
+UINT32 MidiTrack::GetEventCount(void) const
+{
+	return _events.size();
+}
+
+UINT32 MidiTrack::GetTickCount(void) const
+{
+	return _events.empty() ? 0 : _events.back().tick;
+}
+
+const MidiEvtList& MidiTrack::GetEvents(void) const
+{
+	return _events;
+}
+
+midevt_iterator MidiTrack::GetEventBegin(void)
+{
+	return _events.begin();
+}
+
+midevt_iterator MidiTrack::GetEventEnd(void)
+{
+	return _events.end();
+}
+
+midevt_iterator MidiTrack::GetEventFromTick(UINT32 tick)
+{
+	if (tick >= GetTickCount())
+		return _events.end();
+	
+	return _events.lower_bound(tick);
+}
+
+void MidiTrack::TicksChanged(void)
+{
+	_events.ticks_changed();
+	
+	return;
+}
+
+/*static*/ MidiEvent MidiTrack::CreateEvent_Std(UINT8 Event, UINT8 Val1, UINT8 Val2)
+{
+	MidiEvent newEvt;
+	
+	newEvt.tick = 0;
+	newEvt.rsUse = false;
+	newEvt.evtType = Event;
+	newEvt.evtValA = Val1;
+	newEvt.evtValB = Val2;
+	newEvt.evtData.clear();
+	
+	return newEvt;
+}
+
+/*static*/ MidiEvent MidiTrack::CreateEvent_SysEx(UINT32 DataLen, const void* Data)
+{
+	MidiEvent newEvt;
+	
+	newEvt.tick = 0;
+	newEvt.rsUse = false;
+	newEvt.evtType = 0xF0;
+	newEvt.evtValA = 0x00;
+	newEvt.evtValB = 0x00;
+	newEvt.evtData.resize(DataLen);
+	if (DataLen)
+		memcpy(&newEvt.evtData[0x00], Data, DataLen);
+	
+	return newEvt;
+}
+
+/*static*/ MidiEvent MidiTrack::CreateEvent_Meta(UINT8 Type, UINT32 DataLen, const void* Data)
+{
+	MidiEvent newEvt;
+	
+	newEvt.tick = 0;
+	newEvt.rsUse = false;
+	newEvt.evtType = 0xFF;
+	newEvt.evtValA = Type;
+	newEvt.evtValB = 0x00;
+	newEvt.evtData.resize(DataLen);
+	if (DataLen)
+		memcpy(&newEvt.evtData[0x00], Data, DataLen);
+	
+	return newEvt;
+}
+
+void MidiTrack::AppendEvent(const MidiEvent& Event)
+{
+	if (Event.tick < GetTickCount())
+		return;
+	
+	_events.push_back(Event);
+	
+	return;
+}
+
+void MidiTrack::AppendEvent(UINT32 Delay, MidiEvent Event)
+{
+	// Event is our own copy, so its data can be moved into the track.
+	Event.tick = GetTickCount() + Delay;
+	AppendEventMove(Event);
+	
+	return;
+}
+
+void MidiTrack::AppendEventMove(MidiEvent& Event)
+{
+	if (Event.tick < GetTickCount())
+		return;
+	
+	_events.insert_move(_events.end(), Event);
+	
+	return;
+}
+
+void MidiTrack::AppendEvent(UINT32 Delay, UINT8 Event, UINT8 Val1, UINT8 Val2)
+{
+	AppendEvent(Delay, CreateEvent_Std(Event, Val1, Val2));
+	
+	return;
+}
+
+void MidiTrack::AppendSysEx(UINT32 Delay, UINT32 DataLen, const void* Data)
+{
+	AppendEvent(Delay, CreateEvent_SysEx(DataLen, Data));
+	
+	return;
+}
+
+void MidiTrack::AppendMetaEvent(UINT32 Delay, UINT8 Type, UINT32 DataLen, const void* Data)
+{
+	AppendEvent(Delay, CreateEvent_Meta(Type, DataLen, Data));
+	
+	return;
+}
+
+
+void MidiTrack::InsertEventT(const MidiEvent& Event)
+{
+	midevt_iterator evtIt;
+	
+	evtIt = GetFirstEventAtTick(Event.tick);
+	_events.insert(evtIt, Event);
+	
+	return;
+}
+
+void MidiTrack::InsertEventT(UINT32 tick, MidiEvent Event)
+{
+	Event.tick = tick;
+	InsertEventTMove(Event);
+	
+	return;
+}
+
+void MidiTrack::InsertEventTMove(MidiEvent& Event)
+{
+	midevt_iterator evtIt;
+	
+	evtIt = GetFirstEventAtTick(Event.tick);
+	_events.insert_move(evtIt, Event);
+	
+	return;
+}
+
+void MidiTrack::InsertEventT(UINT32 tick, UINT8 Event, UINT8 Val1, UINT8 Val2)
+{
+	InsertEventT(tick, CreateEvent_Std(Event, Val1, Val2));
+	
+	return;
+}
+
+void MidiTrack::InsertSysExT(UINT32 tick, UINT32 DataLen, const void* Data)
+{
+	InsertEventT(tick, CreateEvent_SysEx(DataLen, Data));
+	
+	return;
+}
+
+void MidiTrack::InsertMetaEventT(UINT32 tick, UINT8 Type, UINT32 DataLen, const void* Data)
+{
+	InsertEventT(tick, CreateEvent_Meta(Type, DataLen, Data));
+	
+	return;
+}
+
+
+
+// insert with previous event and delay
+void MidiTrack::InsertEventD(midevt_iterator prevEvt, const MidiEvent& Event)
+{
+	MidiEvent evtCopy(Event);
+	
+	InsertEventDMove(prevEvt, evtCopy);
+	
+	return;
+}
+
+void MidiTrack::InsertEventD(midevt_iterator prevEvt, UINT32 Delay, MidiEvent Event)
+{
+	if (prevEvt == _events.end() && Delay)
+	{
+		Event.tick = Delay;
+		InsertEventTMove(Event);
+		return;
+	}
+	
+	if (prevEvt == _events.end())
+		Event.tick = 0;
+	else
+		Event.tick = prevEvt->tick + Delay;
+	InsertEventDMove(prevEvt, Event);
+	
+	return;
+}
+
+void MidiTrack::InsertEventDMove(midevt_iterator prevEvt, MidiEvent& Event)
+{
+	if (prevEvt == _events.end())
+	{
+		if (Event.tick >= GetTickCount())
+			AppendEventMove(Event);
+		else if (! Event.tick)
+			_events.insert_move(_events.begin(), Event);
+		return;
+	}
+	if (Event.tick < prevEvt->tick)
+		return;
+	
+	midevt_iterator nextEvt(prevEvt);
+	++nextEvt;
+	if (nextEvt != _events.end() && Event.tick > nextEvt->tick)
+		return;
+	
+	_events.insert_move(nextEvt, Event);
+	
+	return;
+}
+
+void MidiTrack::InsertEventD(midevt_iterator prevEvt, UINT32 Delay, UINT8 Event, UINT8 Val1, UINT8 Val2)
+{
+	InsertEventD(prevEvt, Delay, CreateEvent_Std(Event, Val1, Val2));
+	
+	return;
+}
+
+void MidiTrack::InsertSysExD(midevt_iterator prevEvt, UINT32 Delay, UINT32 DataLen, const void* Data)
+{
+	InsertEventD(prevEvt, Delay, CreateEvent_SysEx(DataLen, Data));
+	
+	return;
+}
+
+void MidiTrack::InsertMetaEventD(midevt_iterator prevEvt, UINT32 Delay, UINT8 Type, UINT32 DataLen, const void* Data)
+{
+	InsertEventD(prevEvt, Delay, CreateEvent_Meta(Type, DataLen, Data));
+	
+	return;
+}
+
+void MidiTrack::RemoveEvent(midevt_iterator evtIt)
+{
+	_events.erase(evtIt);
+	
+	return;
+}
+
+midevt_iterator MidiTrack::MoveEventTo(MidiTrack& dst, midevt_iterator evtIt)
+{
+	midevt_iterator nextEvt(evtIt);
+	midevt_iterator dstPos;
+	
+	++nextEvt;
+	if (evtIt->tick >= dst.GetTickCount())
+		dstPos = dst._events.end();	// the usual case: append
+	else
+		dstPos = dst._events.lower_bound(evtIt->tick + 1);
+	dst._events.splice(dstPos, _events, evtIt);
+	
+	return nextEvt;
+}
+
+void MidiTrack::ScaleTicks(UINT32 mul, UINT32 div)
+{
+	_events.scale_ticks(mul, div);
+	
+	return;
+}
+
+void MidiTrack::ApplyEdits(MidiEditBatch& edits)
+{
+	if (! edits.IsEmpty())
+		_events.apply_edits(edits);
+	edits.Clear();
+	
+	return;
+}
+
+midevt_iterator MidiTrack::GetFirstEventAtTick(UINT32 tick)
+{
+	if (tick > GetTickCount())
+		return _events.end();
+	
+	return _events.lower_bound(tick);
+}
+
+
+// --- MidiFile Class ---
+MidiFile::MidiFile(void)
+{
+	_format = 1;
+	//_trackCount = 0;
+	_resolution = 96;
+	//this->FirstTrack = NULL;
+	_mapData = NULL;
+	_mapSize = 0;
+	_compact = false;
+	
+	return;
+}
+
+MidiFile::~MidiFile()
+{
+	ClearAll();
+	
+	return;
+}
+
+void MidiFile::ClearAll()
+{
+	std::vector<MidiTrack*>::iterator trkIt;
+	std::vector<MidiArena*>::iterator arenaIt;
+	
+	for (trkIt = _tracks.begin(); trkIt != _tracks.end(); ++trkIt)
+		delete *trkIt;
+	_tracks.clear();
+	// The event data was freed together with the arenas. The arenas (and their first blocks) go to the
+	// thread's cache, so that the next file can use them, even if it is loaded by another MidiFile object.
+	for (arenaIt = _arenas.begin(); arenaIt != _arenas.end(); ++arenaIt)
+		CacheArena(*arenaIt);
+	_arenas.clear();
+	
+	// unmap after deleting the tracks, as their events may reference the mapped file
+	if (_mapData != NULL)
+	{
+		UnmapFileData(_mapData, _mapSize);
+		_mapData = NULL;
+		_mapSize = 0;
+	}
+	
+	return;
+}
+
+UINT16 MidiFile::GetMidiFormat(void) const
+{
+	return _format;
+}
+
+UINT16 MidiFile::GetMidiResolution(void) const
+{
+	return _resolution;
+}
+
+UINT16 MidiFile::GetTrackCount(void) const
+{
+	return (UINT16)_tracks.size();
+}
+
+MidiTrack* MidiFile::GetTrack(UINT16 trackID)
+{
+	return (trackID < _tracks.size()) ? _tracks[trackID] : NULL;
+}
+
+UINT8 MidiFile::SetMidiFormat(UINT16 newFormat)
+{
+	if (newFormat > 2)
+		return 0xFF;
+	
+	if (newFormat == 0 && GetTrackCount() > 1)
+		return 0x01;
+	
+	_format = newFormat;
+	
+	return 0x00;
+}
+
+UINT8 MidiFile::SetMidiResolution(UINT16 newResolution)
+{
+	if (! newResolution || newResolution > 0x7FFF)
+		return 0xFF;
+	
+	_resolution = newResolution;
+	
+	return 0x00;
+}
+
+UINT8 MidiFile::ConvertMidiResolution(UINT16 newResolution)
+{
+	UINT32 scaleMul;
+	UINT32 scaleDiv;
+	UINT32 gcd;
+	size_t curTrk;
+	
+	if (! newResolution || newResolution > 0x7FFF)
+		return 0xFF;
+	if (! _resolution || _resolution > 0x7FFF)
+		return 0xFF;	// SMPTE timing can't be converted
+	if (newResolution == _resolution)
+		return 0x00;
+	
+	gcd = GetGCD(newResolution, _resolution);
+	scaleMul = newResolution / gcd;
+	scaleDiv = _resolution / gcd;
+	for (curTrk = 0; curTrk < _tracks.size(); curTrk ++)
+	{
+		UINT64 lastTick = ((UINT64)_tracks[curTrk]->GetTickCount() * scaleMul + scaleDiv / 2) / scaleDiv;
+		if (lastTick > 0xFFFFFFFF)
+			return 0x01;
+	}
+	
+	for (curTrk = 0; curTrk < _tracks.size(); curTrk ++)
+		_tracks[curTrk]->ScaleTicks(scaleMul, scaleDiv);
+	_resolution = newResolution;
+	
+	return 0x00;
+}
+
+static UINT32 GetGCD(UINT32 a, UINT32 b)
+{
+	while(b)
+	{
+		UINT32 tmp = a % b;
+		a = b;
+		b = tmp;
+	}
+	return a;
+}
+
+UINT8 MidiFile::ConvertMidiFormat(UINT16 newFormat)
+{
+	if (newFormat > 2)
+		return 0xFF;
+	
+	if (newFormat == 0 && GetTrackCount() > 1)
+	{
+		// k-way merge of all tracks, using a min-heap that holds the next event of each track
+		MidiTrack* newTrk = new MidiTrack;
+		std::vector<midevt_iterator> trkEvts(_tracks.size());
+		std::vector<TrackMergeEntry> mergeHeap;
+		UINT32 eotTick;
+		size_t evtCount;
+		size_t curTrk;
+		
+		eotTick = 0;
+		evtCount = 0;
+		mergeHeap.reserve(_tracks.size());
+		for (curTrk = 0; curTrk < _tracks.size(); curTrk ++)
+		{
+			evtCount += _tracks[curTrk]->GetEventCount();
+			trkEvts[curTrk] = _tracks[curTrk]->GetEventBegin();
+			if (trkEvts[curTrk] != _tracks[curTrk]->GetEventEnd())
+			{
+				TrackMergeEntry tme;
+				tme.tick = trkEvts[curTrk]->tick;
+				tme.trkID = (UINT16)curTrk;
+				mergeHeap.push_back(tme);
+			}
+		}
+		std::make_heap(mergeHeap.begin(), mergeHeap.end(), &MergeEntryGreater);
+		newTrk->_events.reserve(evtCount + 1);	// +1 for the final End-Of-Track event
+		
+		while(! mergeHeap.empty())
+		{
+			std::pop_heap(mergeHeap.begin(), mergeHeap.end(), &MergeEntryGreater);
+			TrackMergeEntry& tme = mergeHeap.back();
+			midevt_iterator& evtIt = trkEvts[tme.trkID];
+			
+			if (eotTick < evtIt->tick)
+				eotTick = evtIt->tick;
+			if (! (evtIt->evtType == 0xFF && evtIt->evtValA == 0x2F))	// skip End-Of-Track events
+				newTrk->AppendEventMove(*evtIt);	// the source tracks are deleted afterwards
+			
+			++evtIt;
+			if (evtIt != _tracks[tme.trkID]->GetEventEnd())
+			{
+				tme.tick = evtIt->tick;
+				std::push_heap(mergeHeap.begin(), mergeHeap.end(), &MergeEntryGreater);
+			}
+			else
+			{
+				mergeHeap.pop_back();
+			}
+		}
+		newTrk->AppendMetaEvent(eotTick - newTrk->GetTickCount(), 0x2F, 0x00, NULL);
+		
+		for (curTrk = 0; curTrk < _tracks.size(); curTrk ++)
+			delete _tracks[curTrk];
+		_tracks.assign(1, newTrk);
+	}
+	_format = newFormat;
+	
+	return 0x00;
+}
+
+static bool MergeEntryGreater(const TrackMergeEntry& a, const TrackMergeEntry& b)
+{
+	if (a.tick != b.tick)
+		return a.tick > b.tick;
+	return a.trkID > b.trkID;
+}
+
+MidiTrack* MidiFile::NewTrack_Append(void)
+{
+	MidiTrack* newTrk = new MidiTrack();
+	MidiTrack* retVal;
+	
+	retVal = Track_Append(newTrk);
+	if (retVal == NULL)
+		delete newTrk;
+	return retVal;
+}
+
+MidiTrack* MidiFile::Track_Append(MidiTrack* trkData)
+{
+	if (GetTrackCount() >= 0x8000)
+		return NULL;
+	
+	_tracks.push_back(trkData);
+	
+	return _tracks.back();
+}
+
+MidiTrack* MidiFile::NewTrack_Insert(UINT16 newTrackID)
+{
+	MidiTrack* newTrk = new MidiTrack();
+	MidiTrack* retVal;
+	
+	retVal = Track_Insert(newTrackID, newTrk);
+	if (retVal == NULL)
+		delete newTrk;
+	return retVal;
+}
+
+MidiTrack* MidiFile::Track_Insert(UINT16 newTrackID, MidiTrack* trkData)
+{
+	if (newTrackID > GetTrackCount())
+		return NULL;
+	else if (newTrackID == GetTrackCount())
+		return Track_Append(trkData);
+	
+	_tracks.insert(_tracks.begin() + newTrackID, trkData);
+	
+	return _tracks[newTrackID];
+}
+
+UINT8 MidiFile::DeleteTrack(UINT16 trackID)
+{
+	if (trackID >= GetTrackCount())
+		return 0xFF;
+	
+	delete _tracks[trackID];
+	_tracks.erase(_tracks.begin() + trackID);
+	
+	return 0x00;
+}
+
+
+UINT8 MidiFile::LoadFile(const char* fileName)
+{
+	FILE* infile;
+	UINT8 retVal;
+	
+	infile = fopen(fileName, "rb");
+	if (infile == NULL)
+		return 0xFF;
+	
+	retVal = LoadFile(infile);
+	fclose(infile);
+	
+	return retVal;
+}
+
+UINT8 MidiFile::LoadFile(FILE* infile)
+{
+	long StartPos;
+	long EndPos;
+	std::vector<UINT8> FileData;
+	UINT32 FileLen;
+	
+	StartPos = ftell(infile);
+	fseek(infile, 0, SEEK_END);
+	EndPos = ftell(infile);
+	fseek(infile, StartPos, SEEK_SET);
+	if (StartPos < 0 || EndPos <= StartPos)
+		return 0x10;
+	
+	// read the whole file with one call and parse it from memory
+	FileData.resize(EndPos - StartPos);
+	FileLen = (UINT32)fread(&FileData[0x00], 0x01, FileData.size(), infile);
+	if (! FileLen)
+		return 0x10;
+	
+	return LoadBuffer(FileLen, &FileData[0x00], false);
+}
+
+UINT8 MidiFile::LoadFile(UINT32 FileLen, const UINT8* FileData)
+{
+	return LoadBuffer(FileLen, FileData, false);
+}
+
+UINT8 MidiFile::LoadFileMapped(const char* fileName)
+{
+	UINT8* mapData;
+	UINT32 mapSize;
+	UINT8 retVal;
+	
+	ClearAll();
+	
+	mapData = MapFileData(fileName, &mapSize, false);
+	if (mapData == NULL)
+		return 0xFF;
+	
+	retVal = LoadBuffer(mapSize, mapData, true);
+	if (_tracks.empty())
+	{
+		// nothing references the file
+		UnmapFileData(mapData, mapSize);
+		return retVal;
+	}
+	_mapData = mapData;
+	_mapSize = mapSize;
+	
+	return retVal;
+}
 
-void MidiTrack::InsertMetaEventD(midevt_iterator prevEvt, UINT32 Delay, UINT8 Type, UINT32 DataLen, const void* Data)
+UINT8 MidiFile::LoadBuffer(UINT32 FileLen, const UINT8* FileData, bool refData)
 {
-	InsertEventD(prevEvt, Delay, CreateEvent_Meta(Type, DataLen, Data));
+	UINT32 TempLng;
+	UINT32 CurPos;
+	UINT32 HdrEnd;
+	UINT16 trkCnt;
+	UINT16 CurTrk;
+	UINT8 RetVal;
+	std::vector<UINT32> chunkPos;
+	std::vector<UINT32> chunkSize;
+	std::vector<MidiTrack*> newTracks;
+	std::vector<UINT8> trkRetVals;
+	TrackReadJob readJob;
+	
+	if (FileLen < 0x08)
+		return 0x10;
+	memcpy(&TempLng, &FileData[0x00], 0x04);
+	if (TempLng != FCC_MTHD)
+		return 0x10;
+	
+	TempLng = ReadBE32(&FileData[0x04]);	// Read Header Length
+	if (FileLen < 0x0E || TempLng < 0x06 || TempLng > FileLen - 0x08)
+		return 0x11;
+	HdrEnd = 0x08 + TempLng;
+	
+	ClearAll();
+	
+	_format = ReadBE16(&FileData[0x08]);
+	trkCnt = ReadBE16(&FileData[0x0A]);
+	_resolution = ReadBE16(&FileData[0x0C]);
+	
+	// Pass 1: locate all "MTrk" chunks
+	RetVal = 0x00;
+	CurPos = HdrEnd;
+	chunkPos.reserve(trkCnt);
+	chunkSize.reserve(trkCnt);
+	for (CurTrk = 0; CurTrk < trkCnt; CurTrk ++)
+	{
+		if (FileLen - CurPos < 0x08)
+		{
+			RetVal = 0x10;
+			break;
+		}
+		memcpy(&TempLng, &FileData[CurPos], 0x04);
+		if (TempLng != FCC_MTRK)
+		{
+			RetVal = 0x10;
+			break;
+		}
+		TempLng = ReadBE32(&FileData[CurPos + 0x04]);
+		if (TempLng > FileLen - CurPos - 0x08)
+			TempLng = FileLen - CurPos - 0x08;	// truncated chunk
+		chunkPos.push_back(CurPos);
+		chunkSize.push_back(0x08 + TempLng);
+		CurPos += 0x08 + TempLng;
+	}
+	
+	// Pass 2: decode the tracks, independent tracks are processed concurrently
+	newTracks.resize(chunkPos.size());
+	trkRetVals.resize(chunkPos.size());
+	for (CurTrk = 0; CurTrk < newTracks.size(); CurTrk ++)
+		newTracks[CurTrk] = new MidiTrack;
+	while(_arenas.size() < newTracks.size())
+		_arenas.push_back(GetCachedArena());
+	readJob.fileData = FileData;
+	readJob.chunkPos = chunkPos.empty() ? NULL : &chunkPos[0];
+	readJob.chunkSize = chunkSize.empty() ? NULL : &chunkSize[0];
+	readJob.tracks = newTracks.empty() ? NULL : &newTracks[0];
+	readJob.arenas = _arenas.empty() ? NULL : &_arenas[0];
+	readJob.retVals = trkRetVals.empty() ? NULL : &trkRetVals[0];
+	readJob.refData = refData;
+	RunParallel(newTracks.size(), &ReadTrackFunc, &readJob, (FileLen < PARALLEL_MIN_SIZE) ? 1 : 0);
+	
+	// keep all tracks up to the first broken one, like a sequential loader would do
+	_tracks.reserve(newTracks.size());
+	for (CurTrk = 0; CurTrk < newTracks.size(); CurTrk ++)
+	{
+		if (trkRetVals[CurTrk])
+		{
+			RetVal = trkRetVals[CurTrk];
+			break;
+		}
+		Track_Append(newTracks[CurTrk]);
+	}
+	for (; CurTrk < newTracks.size(); CurTrk ++)
+		delete newTracks[CurTrk];
+	
+	return RetVal;
+}
+
+static void ReadTrackFunc(void* userData, size_t index)
+{
+	TrackReadJob* job = (TrackReadJob*)userData;
+	
+	job->retVals[index] = job->tracks[index]->ReadFromBuffer(job->chunkSize[index],
+		&job->fileData[job->chunkPos[index]], NULL, job->refData, job->arenas[index]);
 	
 	return;
 }
 
-void MidiTrack::RemoveEvent(midevt_iterator evtIt)
+UINT8 MidiFile::SaveFile(const char* fileName)
 {
-	_events.erase(evtIt);
+	FILE* outfile;
+	std::vector< std::vector<UINT8> > Chunks;
+	UINT8 retVal;
+	
+	// Generate the data before opening the file, because the output file
+	// may be the same as a memory-mapped input file.
+	retVal = EncodeChunks(Chunks);
+	if (retVal)
+		return retVal;
+	
+	outfile = fopen(fileName, "wb");
+	if (outfile == NULL)
+		return 0xFF;
+	
+	retVal = WriteChunks(outfile, Chunks);
+	fclose(outfile);
+	
+	return retVal;
+}
+
+UINT8 MidiFile::SaveFile(FILE* outfile)
+{
+	std::vector< std::vector<UINT8> > Chunks;
+	UINT8 RetVal;
+	
+	RetVal = EncodeChunks(Chunks);
+	if (RetVal)
+		return RetVal;
+	
+	return WriteChunks(outfile, Chunks);
+}
+
+UINT8 MidiFile::SaveFile(UINT32* RetFileSize, UINT8** RetFileData)
+{
+	std::vector< std::vector<UINT8> > Chunks;
+	size_t FileSize;
+	size_t CurChk;
+	UINT8 RetVal;
+	
+	*RetFileSize = 0;
+	*RetFileData = NULL;
+	RetVal = EncodeChunks(Chunks);
+	if (RetVal)
+		return RetVal;
+	
+	// the chunk sizes are known, so the chunks are copied straight to their final place
+	FileSize = 0;
+	for (CurChk = 0; CurChk < Chunks.size(); CurChk ++)
+		FileSize += Chunks[CurChk].size();
+	*RetFileData = (UINT8*)malloc(FileSize);
+	if (*RetFileData == NULL)
+		return 0xFF;
+	FileSize = 0;
+	for (CurChk = 0; CurChk < Chunks.size(); CurChk ++)
+	{
+		memcpy(*RetFileData + FileSize, &Chunks[CurChk][0x00], Chunks[CurChk].size());
+		FileSize += Chunks[CurChk].size();
+	}
+	*RetFileSize = (UINT32)FileSize;
+	
+	return 0x00;
+}
+
+void MidiFile::SetCompactOutput(bool compact)
+{
+	_compact = compact;
 	
 	return;
 }
 
-midevt_iterator MidiTrack::GetFirstEventAtTick(UINT32 tick)
+UINT8 MidiFile::EncodeChunks(std::vector< std::vector<UINT8> >& Chunks) const
 {
-	if (tick > GetTickCount())
-		return _events.end();
+	size_t EvtCount;
+	size_t CurTrk;
+	std::vector<UINT8> trkRetVals;
+	TrackWriteJob writeJob;
+	
+	Chunks.clear();
+	Chunks.resize(1 + _tracks.size());
+	
+	std::vector<UINT8>& hdrData = Chunks[0];
+	hdrData.reserve(0x0E);
+	WriteFCC(hdrData, FCC_MTHD);
+	WriteBE32(hdrData, 0x00000006);
+	WriteBE16(hdrData, _format);
+	WriteBE16(hdrData, GetTrackCount());
+	WriteBE16(hdrData, _resolution);
+	
+	// each track is encoded into its own buffer, so that they can be processed concurrently
+	EvtCount = 0;
+	for (CurTrk = 0; CurTrk < _tracks.size(); CurTrk ++)
+		EvtCount += _tracks[CurTrk]->GetEventCount();
+	trkRetVals.resize(_tracks.size());
+	writeJob.tracks = _tracks.empty() ? NULL : &_tracks[0];
+	writeJob.chunks = (Chunks.size() > 1) ? &Chunks[1] : NULL;
+	writeJob.retVals = trkRetVals.empty() ? NULL : &trkRetVals[0];
+	writeJob.compact = _compact;
+	RunParallel(_tracks.size(), &WriteTrackFunc, &writeJob, (EvtCount * 4 < PARALLEL_MIN_SIZE) ? 1 : 0);
+	
+	for (CurTrk = 0; CurTrk < trkRetVals.size(); CurTrk ++)
+	{
+		if (trkRetVals[CurTrk])
+			return trkRetVals[CurTrk];
+	}
 	
-	midevt_iterator evtIt;
+	return 0x00;
+}
+
+static void WriteTrackFunc(void* userData, size_t index)
+{
+	TrackWriteJob* job = (TrackWriteJob*)userData;
 	
-	for (evtIt = _events.begin(); evtIt != _events.end(); ++evtIt)
+	job->retVals[index] = job->tracks[index]->WriteToBuffer(job->chunks[index], job->compact);
+	
+	return;
+}
+
+static UINT8 WriteChunks(FILE* outfile, const std::vector< std::vector<UINT8> >& chunks)
+{
+	size_t curChk;
+	
+	// The chunks are written directly from their buffers, without joining them first.
+	for (curChk = 0; curChk < chunks.size(); curChk ++)
 	{
-		if (evtIt->tick >= tick)
-			return evtIt;
+		const std::vector<UINT8>& chkData = chunks[curChk];
+		if (fwrite(&chkData[0x00], 0x01, chkData.size(), outfile) < chkData.size())
+			return 0xFF;
 	}
 	
-	return _events.end();
+	return 0x00;
 }
 
+// --- MidiTempoMap Class ---
+MidiTempoMap::MidiTempoMap(void)
+{
+	Clear();
+	
+	return;
+}
 
-// --- MidiFile Class ---
-MidiFile::MidiFile(void)
+void MidiTempoMap::Clear(void)
 {
-	_format = 1;
-	//_trackCount = 0;
-	_resolution = 96;
-	//this->FirstTrack = NULL;
+	TempoChg tc;
+	
+	tc.tick = 0;
+	tc.tempo = 500000;	// default: 120 BPM
+	tc.tmrTick = 0;
+	_tempos.assign(1, tc);
+	_tickDiv = 96;
 	
 	return;
 }
 
-MidiFile::~MidiFile()
+/*static*/ bool MidiTempoMap::TempoChgLess(const TempoChg& first, const TempoChg& second)
 {
-	ClearAll();
+	return (first.tick < second.tick);
+}
+
+void MidiTempoMap::Build(MidiFile& midFile)
+{
+	UINT16 resolution = midFile.GetMidiResolution();
+	std::vector<TempoChg> tempoEvts;
+	UINT16 curTrk;
+	size_t curTmp;
+	
+	Clear();
+	if (resolution & 0x8000)
+	{
+		// SMPTE timing: fixed number of ticks per second, Set Tempo events have no effect
+		UINT8 fps = (UINT8)-(INT8)(resolution >> 8);
+		UINT8 tpf = (UINT8)(resolution & 0xFF);
+		if (fps == 29)	// 29 means 29.97 fps (drop frame)
+		{
+			_tickDiv = 2997 * tpf;
+			_tempos[0].tempo = 100000000;
+		}
+		else
+		{
+			_tickDiv = fps * tpf;
+			_tempos[0].tempo = 1000000;
+		}
+		if (! _tickDiv)
+			_tickDiv = 1;
+		return;
+	}
+	_tickDiv = resolution ? resolution : 1;
+	
+	// Note: For Format 2 files, the tempo events of all tracks are combined.
+	for (curTrk = 0; curTrk < midFile.GetTrackCount(); curTrk ++)
+	{
+		MidiTrack* midiTrk = midFile.GetTrack(curTrk);
+		midevt_iterator evtIt;
+		
+		for (evtIt = midiTrk->GetEventBegin(); evtIt != midiTrk->GetEventEnd(); ++evtIt)
+		{
+			if (evtIt->evtType == 0xFF && evtIt->evtValA == 0x51 && evtIt->evtData.size() >= 3)
+			{
+				const MidiEvtData& evtData = evtIt->evtData;
+				TempoChg tc;
+				
+				tc.tick = evtIt->tick;
+				tc.tempo = (evtData[0] << 16) | (evtData[1] << 8) | (evtData[2] << 0);
+				tc.tmrTick = 0;
+				if (tc.tempo)	// a tempo of 0 is invalid
+					tempoEvts.push_back(tc);
+			}
+		}
+	}
+	std::stable_sort(tempoEvts.begin(), tempoEvts.end(), &TempoChgLess);
+	
+	// prefix sum of the time at each tempo change
+	for (curTmp = 0; curTmp < tempoEvts.size(); curTmp ++)
+	{
+		TempoChg& lastTC = _tempos.back();
+		TempoChg& tc = tempoEvts[curTmp];
+		
+		if (tc.tick == lastTC.tick)
+		{
+			lastTC.tempo = tc.tempo;	// the last event at a tick wins
+			continue;
+		}
+		if (tc.tempo == lastTC.tempo)
+			continue;
+		tc.tmrTick = lastTC.tmrTick + (UINT64)(tc.tick - lastTC.tick) * lastTC.tempo;
+		_tempos.push_back(tc);
+	}
 	
 	return;
 }
 
-void MidiFile::ClearAll()
+size_t MidiTempoMap::GetTempoCount(void) const
 {
-	std::vector<MidiTrack*>::iterator trkIt;
+	return _tempos.size();
+}
+
+size_t MidiTempoMap::FindTick(UINT32 tick) const
+{
+	// search the last tempo change at or before the tick (entry 0 is always at tick 0)
+	size_t idxL = 1;
+	size_t idxH = _tempos.size();
+	while(idxL < idxH)
+	{
+		size_t idxM = (idxL + idxH) / 2;
+		if (_tempos[idxM].tick <= tick)
+			idxL = idxM + 1;
+		else
+			idxH = idxM;
+	}
+	return idxL - 1;
+}
+
+size_t MidiTempoMap::FindTime(UINT64 tmrTick) const
+{
+	size_t idxL = 1;
+	size_t idxH = _tempos.size();
+	while(idxL < idxH)
+	{
+		size_t idxM = (idxL + idxH) / 2;
+		if (_tempos[idxM].tmrTick <= tmrTick)
+			idxL = idxM + 1;
+		else
+			idxH = idxM;
+	}
+	return idxL - 1;
+}
+
+UINT64 MidiTempoMap::TickToTime(size_t idx, UINT32 tick) const
+{
+	const TempoChg& tc = _tempos[idx];
+	return tc.tmrTick + (UINT64)(tick - tc.tick) * tc.tempo;
+}
+
+UINT32 MidiTempoMap::TimeToTick(size_t idx, UINT64 tmrTick) const
+{
+	const TempoChg& tc = _tempos[idx];
+	UINT64 tick = tc.tick + (tmrTick - tc.tmrTick) / tc.tempo;
+	return (tick < 0xFFFFFFFF) ? (UINT32)tick : 0xFFFFFFFF;
+}
+
+UINT64 MidiTempoMap::Tick2Usec(UINT32 tick) const
+{
+	return TickToTime(FindTick(tick), tick) / _tickDiv;
+}
+
+// returns the last tick whose time is <= usec, so that Usec2Tick(Tick2Usec(tick)) == tick
+UINT32 MidiTempoMap::Usec2Tick(UINT64 usec) const
+{
+	UINT64 tmrTick = (usec + 1) * _tickDiv - 1;
+	return TimeToTick(FindTime(tmrTick), tmrTick);
+}
+
+void MidiTempoMap::Tick2Usec(size_t count, const UINT32* ticks, UINT64* usecs) const
+{
+	size_t curVal;
+	size_t idx = 0;
 	
-	for (trkIt = _tracks.begin(); trkIt != _tracks.end(); ++trkIt)
-		delete *trkIt;
-	_tracks.clear();
+	for (curVal = 0; curVal < count; curVal ++)
+	{
+		if (curVal == 0 || ticks[curVal] < ticks[curVal - 1])
+		{
+			idx = FindTick(ticks[curVal]);
+		}
+		else
+		{
+			// ascending: continue from the previous tempo change
+			while(idx + 1 < _tempos.size() && _tempos[idx + 1].tick <= ticks[curVal])
+				idx ++;
+		}
+		usecs[curVal] = TickToTime(idx, ticks[curVal]) / _tickDiv;
+	}
 	
 	return;
 }
 
-UINT16 MidiFile::GetMidiFormat(void) const
+void MidiTempoMap::Usec2Tick(size_t count, const UINT64* usecs, UINT32* ticks) const
+{
+	size_t curVal;
+	size_t idx = 0;
+	
+	for (curVal = 0; curVal < count; curVal ++)
+	{
+		UINT64 tmrTick = (usecs[curVal] + 1) * _tickDiv - 1;
+		if (curVal == 0 || usecs[curVal] < usecs[curVal - 1])
+		{
+			idx = FindTime(tmrTick);
+		}
+		else
+		{
+			while(idx + 1 < _tempos.size() && _tempos[idx + 1].tmrTick <= tmrTick)
+				idx ++;
+		}
+		ticks[curVal] = TimeToTick(idx, tmrTick);
+	}
+	
+	return;
+}
+
+
+// --- MidiEvtReader Class ---
+MidiEvtReader::MidiEvtReader(void)
+{
+	_mapData = NULL;
+	_mapSize = 0;
+	_fileData = NULL;
+	_fileLen = 0;
+	Close();
+	
+	return;
+}
+
+MidiEvtReader::~MidiEvtReader()
+{
+	Close();
+	
+	return;
+}
+
+UINT8 MidiEvtReader::OpenFile(const char* fileName, bool writable)
+{
+	UINT8* mapData;
+	UINT32 mapSize;
+	UINT8 retVal;
+	
+	Close();
+	
+	mapData = MapFileData(fileName, &mapSize, writable);
+	if (mapData == NULL)
+		return 0xFF;
+	
+	retVal = OpenBuffer(mapSize, mapData);
+	if (retVal)
+	{
+		UnmapFileData(mapData, mapSize);
+		return retVal;
+	}
+	_mapData = mapData;
+	_mapSize = mapSize;
+	_writable = writable;
+	
+	return 0x00;
+}
+
+UINT8 MidiEvtReader::OpenBuffer(UINT32 FileLen, const UINT8* FileData)
+{
+	UINT32 TempLng;
+	UINT32 HdrEnd;
+	
+	Close();
+	
+	if (FileLen < 0x08)
+		return 0x10;
+	memcpy(&TempLng, &FileData[0x00], 0x04);
+	if (TempLng != FCC_MTHD)
+		return 0x10;
+	
+	TempLng = ReadBE32(&FileData[0x04]);	// Read Header Length
+	if (FileLen < 0x0E || TempLng < 0x06 || TempLng > FileLen - 0x08)
+		return 0x11;
+	HdrEnd = 0x08 + TempLng;
+	
+	_fileData = FileData;
+	_fileLen = FileLen;
+	_format = ReadBE16(&FileData[0x08]);
+	_trkCnt = ReadBE16(&FileData[0x0A]);
+	_resolution = ReadBE16(&FileData[0x0C]);
+	_chunkPos = HdrEnd;
+	
+	return 0x00;
+}
+
+void MidiEvtReader::Close(void)
+{
+	if (_mapData != NULL)
+	{
+		UnmapFileData(_mapData, _mapSize);
+		_mapData = NULL;
+		_mapSize = 0;
+	}
+	_fileData = NULL;
+	_fileLen = 0;
+	_format = 0;
+	_trkCnt = 0;
+	_resolution = 0;
+	_curTrk = 0;
+	_chunkPos = 0;
+	_curPos = 0;
+	_trkEnd = 0;
+	_curTick = 0;
+	_lastEvt = 0x00;
+	_evtPos = 0;
+	_writable = false;
+	
+	return;
+}
+
+UINT16 MidiEvtReader::GetMidiFormat(void) const
 {
 	return _format;
 }
 
-UINT16 MidiFile::GetMidiResolution(void) const
+UINT16 MidiEvtReader::GetMidiResolution(void) const
 {
 	return _resolution;
 }
 
-UINT16 MidiFile::GetTrackCount(void) const
+UINT16 MidiEvtReader::GetTrackCount(void) const
+{
+	return _trkCnt;
+}
+
+UINT8 MidiEvtReader::NextTrack(void)
+{
+	UINT32 TempLng;
+	
+	if (_curTrk >= _trkCnt)
+		return 0x01;	// all tracks were read
+	if (_fileLen - _chunkPos < 0x08)
+		return 0x10;
+	memcpy(&TempLng, &_fileData[_chunkPos], 0x04);
+	if (TempLng != FCC_MTRK)
+		return 0x10;
+	
+	TempLng = ReadBE32(&_fileData[_chunkPos + 0x04]);	// Read Track Length
+	_curPos = _chunkPos + 0x08;
+	_trkEnd = _curPos + TempLng;
+	if (_trkEnd > _fileLen || _trkEnd < _curPos)
+		_trkEnd = _fileLen;	// truncated chunk - read as much as possible
+	_chunkPos = _trkEnd;
+	_curTrk ++;
+	
+	_curTick = 0;
+	_lastEvt = 0x00;
+	
+	return 0x00;
+}
+
+UINT8 MidiEvtReader::ReadEvent(MidiEvent& evt)
+{
+	UINT8 retVal;
+	
+	if (_curPos >= _trkEnd)
+		return 0xFF;
+	
+	retVal = ReadMidiEvent(_fileData, _trkEnd, &_curPos, &_curTick, &_lastEvt, &evt, true, NULL, &_evtPos);
+	if (retVal == 0x01)
+		_curPos = _trkEnd;	// can't continue after an invalid event
+	return retVal;
+}
+
+UINT32 MidiEvtReader::GetEventOffset(void) const
 {
-	return (UINT16)_tracks.size();
+	return _evtPos;
 }
 
-MidiTrack* MidiFile::GetTrack(UINT16 trackID)
+UINT32 MidiEvtReader::GetEventSize(void) const
 {
-	return (trackID < _tracks.size()) ? _tracks[trackID] : NULL;
+	return _curPos - _evtPos;
 }
 
-UINT8 MidiFile::SetMidiFormat(UINT16 newFormat)
+UINT8 MidiEvtReader::PatchData(UINT32 offset, UINT8 value)
 {
-	if (newFormat > 2)
+	if (! _writable || offset >= _mapSize)
 		return 0xFF;
 	
-	if (newFormat == 0 && GetTrackCount() > 1)
-		return 0x01;
-	
-	_format = newFormat;
+	_mapData[offset] = value;
 	
 	return 0x00;
 }
 
-UINT8 MidiFile::SetMidiResolution(UINT16 newResolution)
+
+// --- MidiEvtWriter Class ---
+MidiEvtWriter::MidiEvtWriter(void)
 {
-	if (! newResolution || newResolution > 0x7FFF)
-		return 0xFF;
-	
-	_resolution = newResolution;
+	_hFile = NULL;
+	_trkPos = 0;
+	_trkCnt = 0;
+	_curTick = 0;
+	_lastEvt = 0x00;
+	_compact = false;
 	
-	return 0x00;
+	return;
 }
 
-MidiTrack* MidiFile::NewTrack_Append(void)
+MidiEvtWriter::~MidiEvtWriter()
 {
-	MidiTrack* newTrk = new MidiTrack();
-	MidiTrack* retVal;
+	Close();
 	
-	retVal = Track_Append(newTrk);
-	if (retVal == NULL)
-		delete newTrk;
-	return retVal;
+	return;
 }
 
-MidiTrack* MidiFile::Track_Append(MidiTrack* trkData)
+UINT8 MidiEvtWriter::OpenFile(const char* fileName, UINT16 format, UINT16 resolution, bool compact)
 {
-	if (GetTrackCount() >= 0x8000)
-		return NULL;
+	Close();
 	
-	_tracks.push_back(trkData);
+	_hFile = fopen(fileName, "wb");
+	if (_hFile == NULL)
+		return 0xFF;
+	_compact = compact;
 	
-	return _tracks.back();
+	_buffer.reserve(0x1000);
+	WriteFCC(_buffer, FCC_MTHD);
+	WriteBE32(_buffer, 0x00000006);
+	WriteBE16(_buffer, format);
+	WriteBE16(_buffer, 0x0000);	// track count is written by Close()
+	WriteBE16(_buffer, resolution);
+	
+	return FlushBuffer();
 }
 
-MidiTrack* MidiFile::NewTrack_Insert(UINT16 newTrackID)
+UINT8 MidiEvtWriter::Close(void)
 {
-	MidiTrack* newTrk = new MidiTrack();
-	MidiTrack* retVal;
+	UINT8 TempArr[0x02];
+	UINT8 RetVal;
 	
-	retVal = Track_Insert(newTrackID, newTrk);
-	if (retVal == NULL)
-		delete newTrk;
-	return retVal;
+	if (_hFile == NULL)
+		return 0x00;
+	
+	RetVal = 0x00;
+	if (_trkPos)
+		RetVal = EndTrack();
+	if (! RetVal)
+	{
+		WriteBE16(TempArr, _trkCnt);
+		fseek(_hFile, 0x0A, SEEK_SET);
+		if (fwrite(TempArr, 0x01, 0x02, _hFile) < 0x02)
+			RetVal = 0xFF;
+	}
+	fclose(_hFile);
+	_hFile = NULL;
+	_buffer.clear();
+	_trkCnt = 0;
+	
+	return RetVal;
 }
 
-MidiTrack* MidiFile::Track_Insert(UINT16 newTrackID, MidiTrack* trkData)
+UINT8 MidiEvtWriter::FlushBuffer(void)
 {
-	if (newTrackID > GetTrackCount())
-		return NULL;
-	else if (newTrackID == GetTrackCount())
-		return Track_Append(trkData);
+	size_t wrtBytes;
 	
-	_tracks.insert(_tracks.begin() + newTrackID, trkData);
+	if (_buffer.empty())
+		return 0x00;
+	wrtBytes = fwrite(&_buffer[0x00], 0x01, _buffer.size(), _hFile);
+	if (wrtBytes < _buffer.size())
+		return 0xFF;
+	_buffer.clear();
 	
-	return _tracks[newTrackID];
+	return 0x00;
 }
 
-UINT8 MidiFile::DeleteTrack(UINT16 trackID)
+UINT8 MidiEvtWriter::BeginTrack(void)
 {
-	if (trackID >= GetTrackCount())
+	UINT8 RetVal;
+	
+	if (_hFile == NULL)
 		return 0xFF;
+	if (_trkPos)
+	{
+		RetVal = EndTrack();
+		if (RetVal)
+			return RetVal;
+	}
+	if (_trkCnt >= 0xFFFF)
+		return 0x01;
 	
-	delete _tracks[trackID];
-	_tracks.erase(_tracks.begin() + trackID);
+	WriteFCC(_buffer, FCC_MTRK);
+	WriteBE32(_buffer, 0x00000000);	// length is written by EndTrack()
+	RetVal = FlushBuffer();
+	if (RetVal)
+		return RetVal;
+	_trkPos = ftell(_hFile);
+	_trkCnt ++;
+	
+	_curTick = 0;
+	_lastEvt = 0x00;
 	
 	return 0x00;
 }
 
-
-UINT8 MidiFile::LoadFile(const char* fileName)
+UINT8 MidiEvtWriter::WriteEvent(const MidiEvent& evt)
 {
-	FILE* infile;
-	UINT8 retVal;
-	
-	infile = fopen(fileName, "rb");
-	if (infile == NULL)
+	if (! _trkPos)
 		return 0xFF;
 	
-	retVal = LoadFile(infile);
-	fclose(infile);
+	WriteMidiEvent(_buffer, evt, evt.tick - _curTick, &_lastEvt, _compact);
+	_curTick = evt.tick;
+	if (_buffer.size() >= 0x1000)
+		return FlushBuffer();
 	
-	return retVal;
+	return 0x00;
 }
 
-UINT8 MidiFile::LoadFile(FILE* infile)
+UINT8 MidiEvtWriter::EndTrack(void)
 {
-	UINT32 TempLng;
-	UINT32 HdrPos;
-	UINT32 HdrEnd;
-	UINT16 trkCnt;
-	UINT16 CurTrk;
+	UINT8 TempArr[0x04];
+	long EndPos;
 	UINT8 RetVal;
 	
-//	fseek(infile, 0, SEEK_END);
-//	file_size = ftell(infile);
-//	fseek(infile, 0, SEEK_SET);
-	
-	fread(&TempLng, 0x04, 1, infile);
-	if (TempLng != FCC_MTHD)
-		return 0x10;
+	if (! _trkPos)
+		return 0xFF;
 	
-	ClearAll();
+	RetVal = FlushBuffer();
+	if (RetVal)
+		return RetVal;
 	
-	TempLng = ReadBE32(infile);	// Read Header Length
-	HdrPos = (UINT32)ftell(infile);
-	HdrEnd = HdrPos + TempLng;
+	EndPos = ftell(_hFile);
+	WriteBE32(TempArr, (UINT32)(EndPos - _trkPos));
+	fseek(_hFile, _trkPos - 0x04, SEEK_SET);
+	if (fwrite(TempArr, 0x01, 0x04, _hFile) < 0x04)
+		RetVal = 0xFF;
+	fseek(_hFile, EndPos, SEEK_SET);
+	_trkPos = 0;
 	
-	_format = ReadBE16(infile);
-	trkCnt = ReadBE16(infile);
-	_resolution = ReadBE16(infile);
+	return RetVal;
+}
+
+static UINT8* MapFileData(const char* fileName, UINT32* retSize, bool writable)
+{
+#ifdef _WIN32
+	HANDLE hFile;
+	HANDLE hMap;
+	DWORD fileSize;
+	UINT8* data;
+	
+	hFile = CreateFileA(fileName, writable ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ, FILE_SHARE_READ,
+						NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return NULL;
+	fileSize = GetFileSize(hFile, NULL);
+	if (fileSize == 0 || fileSize == INVALID_FILE_SIZE)
+	{
+		CloseHandle(hFile);
+		return NULL;
+	}
+	hMap = CreateFileMappingA(hFile, NULL, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(hFile);
+	if (hMap == NULL)
+		return NULL;
+	data = (UINT8*)MapViewOfFile(hMap, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(hMap);	// the view keeps the mapping alive
+	if (data == NULL)
+		return NULL;
 	
-	fseek(infile, HdrEnd, SEEK_SET);
+	*retSize = fileSize;
+	return data;
+#else
+	int hFile;
+	struct stat fileStat;
+	void* data;
 	
-	RetVal = 0x00;
-	_tracks.reserve(trkCnt);
-	for (CurTrk = 0; CurTrk < trkCnt; CurTrk ++)
+	hFile = open(fileName, writable ? O_RDWR : O_RDONLY);
+	if (hFile == -1)
+		return NULL;
+	if (fstat(hFile, &fileStat) == -1 || fileStat.st_size <= 0 || (UINT64)fileStat.st_size > 0xFFFFFFFFU)
 	{
-		MidiTrack* newTrk = new MidiTrack;
-		RetVal = newTrk->ReadFromFile(infile);
-		if (RetVal)
-			break;
-		
-		Track_Append(newTrk);
+		close(hFile);
+		return NULL;
 	}
+	// writable mappings are shared, so that changes go directly to the file
+	if (writable)
+		data = mmap(NULL, fileStat.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, hFile, 0);
+	else
+		data = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE, hFile, 0);
+	close(hFile);	// the mapping stays valid after closing the file
+	if (data == MAP_FAILED)
+		return NULL;
 	
-	return RetVal;
+	*retSize = (UINT32)fileStat.st_size;
+	return (UINT8*)data;
+#endif
 }
 
-UINT8 MidiFile::SaveFile(const char* fileName)
+static void UnmapFileData(UINT8* data, UINT32 size)
 {
-	FILE* outfile;
-	UINT8 retVal;
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+#else
+	munmap(data, size);
+#endif
 	
-	outfile = fopen(fileName, "wb");
-	if (outfile == NULL)
-		return 0xFF;
+	return;
+}
+
+bool IsSameFile(const char* fileName1, const char* fileName2)
+{
+#ifdef _WIN32
+	HANDLE hFile1;
+	HANDLE hFile2;
+	BY_HANDLE_FILE_INFORMATION fileInf1;
+	BY_HANDLE_FILE_INFORMATION fileInf2;
+	bool sameFile;
+	
+	hFile1 = CreateFileA(fileName1, 0, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+	if (hFile1 == INVALID_HANDLE_VALUE)
+		return false;
+	hFile2 = CreateFileA(fileName2, 0, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+	if (hFile2 == INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(hFile1);
+		return false;
+	}
+	sameFile = false;
+	if (GetFileInformationByHandle(hFile1, &fileInf1) && GetFileInformationByHandle(hFile2, &fileInf2))
+	{
+		sameFile = (fileInf1.dwVolumeSerialNumber == fileInf2.dwVolumeSerialNumber &&
+					fileInf1.nFileIndexHigh == fileInf2.nFileIndexHigh &&
+					fileInf1.nFileIndexLow == fileInf2.nFileIndexLow);
+	}
+	CloseHandle(hFile2);
+	CloseHandle(hFile1);
+	
+	return sameFile;
+#else
+	struct stat fileStat1;
+	struct stat fileStat2;
+	
+	if (stat(fileName1, &fileStat1) == -1 || stat(fileName2, &fileStat2) == -1)
+		return false;
+	return (fileStat1.st_dev == fileStat2.st_dev && fileStat1.st_ino == fileStat2.st_ino);
+#endif
+}
+
+static UINT32 GetCPUCount(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO sysInfo;
+	
+	GetSystemInfo(&sysInfo);
+	return sysInfo.dwNumberOfProcessors;
+#else
+	long cpuCnt = sysconf(_SC_NPROCESSORS_ONLN);
+	return (cpuCnt > 0) ? (UINT32)cpuCnt : 1;
+#endif
+}
+
+static MidiArena* GetCachedArena(void)
+{
+	MidiArena* arena;
 	
-	retVal = SaveFile(outfile);
-	fclose(outfile);
+	if (arenaCache == NULL || arenaCache->empty())
+		return new MidiArena;
+	arena = arenaCache->back();
+	arenaCache->pop_back();
 	
-	return retVal;
+	return arena;
 }
 
-UINT8 MidiFile::SaveFile(FILE* outfile)
+static void CacheArena(MidiArena* arena)
 {
-	UINT32 TempLng;
-	UINT32 HdrPos;
-	UINT32 HdrEnd;
-	UINT8 RetVal;
-	std::vector<MidiTrack*>::const_iterator trkIt;
+	if (arenaCache == NULL)
+		arenaCache = new std::vector<MidiArena*>;
+	// Files with many tracks need one arena each, so only a few of them are kept.
+	if (arenaCache->size() >= ARENA_KEEP_MAX)
+	{
+		delete arena;
+		return;
+	}
+	arena->Reset();
+	arenaCache->push_back(arena);
 	
-	TempLng = FCC_MTHD;
-	fwrite(&TempLng, 0x04, 1, outfile);
-	TempLng = 0x00000000;
-	fwrite(&TempLng, 0x04, 1, outfile);
+	return;
+}
+
+static void FreeArenaCache(void)
+{
+	size_t curArena;
 	
-	HdrPos = (UINT32)ftell(outfile);
-	WriteBE16(outfile, _format);
-	WriteBE16(outfile, GetTrackCount());
-	WriteBE16(outfile, _resolution);
-	HdrEnd = (UINT32)ftell(outfile);
+	if (arenaCache == NULL)
+		return;
+	for (curArena = 0; curArena < arenaCache->size(); curArena ++)
+		delete (*arenaCache)[curArena];
+	delete arenaCache;
+	arenaCache = NULL;
 	
-	fseek(outfile, HdrPos - 0x04, SEEK_SET);
-	WriteBE32(outfile, HdrEnd - HdrPos);
+	return;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI ParallelThread(void* param)
+#else
+static void* ParallelThread(void* param)
+#endif
+{
+	DoParallelJob((ParallelJob*)param);
+	FreeArenaCache();	// the thread ends here
 	
-	fseek(outfile, HdrEnd, SEEK_SET);
+	return 0;
+}
+
+static void DoParallelJob(ParallelJob* job)
+{
+	bool oldInJob = inParallelJob;
+	UINT32 oldAllocCnt = allocCount;
+	size_t index;
 	
-	RetVal = 0x00;
-	for (trkIt = _tracks.begin(); trkIt != _tracks.end(); ++trkIt)
+	inParallelJob = true;
+	allocCount = 0;
+	while(true)
 	{
-		RetVal = (*trkIt)->WriteToFile(outfile);
-		if (RetVal)
+#ifdef _WIN32
+		EnterCriticalSection(&job->lock);
+		index = job->next ++;
+		LeaveCriticalSection(&job->lock);
+#else
+		pthread_mutex_lock(&job->lock);
+		index = job->next ++;
+		pthread_mutex_unlock(&job->lock);
+#endif
+		if (index >= job->count)
 			break;
+		job->func(job->userData, index);
 	}
+#ifdef _WIN32
+	EnterCriticalSection(&job->lock);
+	job->allocCount += allocCount;
+	LeaveCriticalSection(&job->lock);
+#else
+	pthread_mutex_lock(&job->lock);
+	job->allocCount += allocCount;
+	pthread_mutex_unlock(&job->lock);
+#endif
+	allocCount = oldAllocCnt;
+	inParallelJob = oldInJob;
 	
-	return RetVal;
+	return;
 }
 
-static UINT16 ReadBE16(FILE* infile)
+void RunParallel(size_t count, PARALLEL_FUNC func, void* userData, UINT32 maxThreads)
 {
-	UINT8 InData[0x02];
+	ParallelJob job;
+	UINT32 thrCnt;
+	UINT32 curThr;
+	
+	if (inParallelJob)
+		maxThreads = 1;	// the outer job keeps all CPUs busy already
+	else if (! maxThreads)
+		maxThreads = GetCPUCount();
+	thrCnt = (count < maxThreads) ? (UINT32)count : maxThreads;
+	if (thrCnt <= 1)
+	{
+		size_t index;
+		for (index = 0; index < count; index ++)
+			func(userData, index);
+		return;
+	}
+	
+	job.func = func;
+	job.userData = userData;
+	job.count = count;
+	job.next = 0;
+	job.allocCount = 0;
+#ifdef _WIN32
+	std::vector<HANDLE> threads;
+	
+	InitializeCriticalSection(&job.lock);
+	for (curThr = 1; curThr < thrCnt; curThr ++)
+	{
+		HANDLE hThread = CreateThread(NULL, 0, &ParallelThread, &job, 0, NULL);
+		if (hThread != NULL)
+			threads.push_back(hThread);
+	}
+	DoParallelJob(&job);
+	for (curThr = 0; curThr < threads.size(); curThr ++)
+	{
+		WaitForSingleObject(threads[curThr], INFINITE);
+		CloseHandle(threads[curThr]);
+	}
+	DeleteCriticalSection(&job.lock);
+#else
+	std::vector<pthread_t> threads;
 	
-	fread(InData, 0x02, 1, infile);
-	return (InData[0x00] << 8) | (InData[0x01] << 0);
+	pthread_mutex_init(&job.lock, NULL);
+	for (curThr = 1; curThr < thrCnt; curThr ++)
+	{
+		pthread_t hThread;
+		if (! pthread_create(&hThread, NULL, &ParallelThread, &job))
+			threads.push_back(hThread);
+	}
+	DoParallelJob(&job);	// if no thread could be created, this does all the work
+	for (curThr = 0; curThr < threads.size(); curThr ++)
+		pthread_join(threads[curThr], NULL);
+	pthread_mutex_destroy(&job.lock);
+#endif
+	allocCount += job.allocCount;
+	
+	return;
 }
 
-static UINT32 ReadBE32(FILE* infile)
+UINT32 GetAllocCount(void)
 {
-	UINT8 InData[0x04];
-	
-	fread(InData, 0x04, 1, infile);
-	return	(InData[0x00] << 24) | (InData[0x01] << 16) |
-			(InData[0x02] <<  8) | (InData[0x03] <<  0);
+	return allocCount;
+}
+
+static UINT16 ReadBE16(const UINT8* data)
+{
+	return (data[0x00] << 8) | (data[0x01] << 0);
 }
 
-static UINT32 ReadMidiValue(FILE* infile)
+static UINT32 ReadBE32(const UINT8* data)
+{
+	return	(data[0x00] << 24) | (data[0x01] << 16) |
+			(data[0x02] <<  8) | (data[0x03] <<  0);
+}
+
+static UINT32 ReadMidiValue(const UINT8* data, UINT32 dataLen, UINT32* curPos)
 {
 	UINT8 TempByt;
 	UINT32 ResVal;
-	size_t readBytes;
+	UINT32 pos;
+	
+	pos = *curPos;
+	if (dataLen - pos >= 0x04)
+	{
+		// fast path: decode up to 4 bytes at once
+		// The "continuation" bits of all 4 bytes select the length from a table.
+		const UINT8* valData = &data[pos];
+		UINT8 valLen = VLQ_LENGTH[	((valData[0x00] & 0x80) >> 4) | ((valData[0x01] & 0x80) >> 5) |
+									((valData[0x02] & 0x80) >> 6) | ((valData[0x03] & 0x80) >> 7)];
+		if (valLen <= 0x04)
+		{
+			ResVal =	((valData[0x00] & 0x7F) << 21) | ((valData[0x01] & 0x7F) << 14) |
+						((valData[0x02] & 0x7F) <<  7) | ((valData[0x03] & 0x7F) <<  0);
+			*curPos = pos + valLen;
+			return ResVal >> (7 * (0x04 - valLen));
+		}
+	}
 	
+	// slow path: end of the buffer or values longer than 4 bytes
 	ResVal = 0x00;
 	do
 	{
-		readBytes = fread(&TempByt, 0x01, 1, infile);
-		if (! readBytes)
+		if (pos >= dataLen)
 			break;
+		TempByt = data[pos];	pos ++;
 		ResVal <<= 7;
 		ResVal |= (TempByt & 0x7F);
 	} while(TempByt & 0x80);
+	*curPos = pos;
 	
 	return ResVal;
 }
 
-static void WriteBE16(FILE* outfile, UINT16 Value)
+static UINT8 ReadMidiEvent(const UINT8* data, UINT32 dataLen, UINT32* curPos, UINT32* curTick, UINT8* lastEvt, MidiEvent* evt, bool refData, MidiArena* arena, UINT32* evtPos)
+{
+	UINT32 TempLng;
+	UINT32 pos;
+	UINT8 CurEvt;
+	UINT8 EvtVal;
+	bool rsUse;
+	
+	pos = *curPos;
+	*curTick += ReadMidiValue(data, dataLen, &pos);
+	*curPos = pos;
+	if (pos >= dataLen)
+		return 0xFF;
+	if (evtPos != NULL)
+		*evtPos = pos;
+	
+	EvtVal = 0x00;
+	CurEvt = data[pos];	pos ++;
+	if (CurEvt < 0x80)
+	{
+		if (*lastEvt < 0x80 || *lastEvt >= 0xF0)
+			return 0x01;
+		EvtVal = CurEvt;
+		CurEvt = *lastEvt;
+		rsUse = true;
+	}
+	else
+	{
+		if (CurEvt < 0xF0)
+		{
+			if (pos >= dataLen)
+				return 0xFF;
+			*lastEvt = CurEvt;
+			EvtVal = data[pos];	pos ++;
+		}
+		rsUse = false;
+	}
+	
+	evt->tick = *curTick;
+	evt->rsUse = rsUse;
+	evt->evtType = CurEvt;
+	evt->evtValA = 0x00;
+	evt->evtValB = 0x00;
+	evt->evtData.clear();
+	switch(CurEvt & 0xF0)
+	{
+	case 0x80:
+	case 0x90:
+	case 0xA0:
+	case 0xB0:
+	case 0xE0:
+		evt->evtValA = EvtVal;
+		if (pos < dataLen)
+		{
+			evt->evtValB = data[pos];	pos ++;
+		}
+		break;
+	case 0xC0:
+	case 0xD0:
+		evt->evtValA = EvtVal;
+		break;
+	case 0xF0:
+		switch(CurEvt)
+		{
+		case 0xFF:
+			if (pos < dataLen)
+			{
+				evt->evtValA = data[pos];	pos ++;
+			}
+			// fall through
+		case 0xF0:
+		case 0xF7:
+			TempLng = ReadMidiValue(data, dataLen, &pos);
+			if (TempLng > dataLen - pos)
+				TempLng = dataLen - pos;
+			if (refData)
+				evt->evtData.assign_ref(&data[pos], &data[pos] + TempLng, arena);
+			else
+				evt->evtData.assign(&data[pos], &data[pos] + TempLng, arena);
+			pos += TempLng;
+			break;
+		}
+	}
+	*curPos = pos;
+	
+	return 0x00;
+}
+
+static void WriteFCC(std::vector<UINT8>& buffer, UINT32 fcc)
+{
+	const UINT8* fccData = reinterpret_cast<const UINT8*>(&fcc);
+	buffer.insert(buffer.end(), fccData, fccData + 0x04);
+	
+	return;
+}
+
+static void WriteBE16(std::vector<UINT8>& buffer, UINT16 Value)
 {
-	UINT8 OutData[0x02];
+	buffer.push_back((Value & 0xFF00) >> 8);
+	buffer.push_back((Value & 0x00FF) >> 0);
 	
-	OutData[0x00] = (Value & 0xFF00) >> 8;
-	OutData[0x01] = (Value & 0x00FF) >> 0;
-	fwrite(OutData, 0x02, 1, outfile);
+	return;
+}
+
+static void WriteBE32(std::vector<UINT8>& buffer, UINT32 Value)
+{
+	buffer.push_back((Value & 0xFF000000) >> 24);
+	buffer.push_back((Value & 0x00FF0000) >> 16);
+	buffer.push_back((Value & 0x0000FF00) >>  8);
+	buffer.push_back((Value & 0x000000FF) >>  0);
 	
 	return;
 }
 
-static void WriteBE32(FILE* outfile, UINT32 Value)
+static void WriteBE16(UINT8* data, UINT16 Value)
 {
-	UINT8 OutData[0x04];
+	data[0x00] = (Value & 0xFF00) >> 8;
+	data[0x01] = (Value & 0x00FF) >> 0;
 	
-	OutData[0x00] = (Value & 0xFF000000) >> 24;
-	OutData[0x01] = (Value & 0x00FF0000) >> 16;
-	OutData[0x02] = (Value & 0x0000FF00) >>  8;
-	OutData[0x03] = (Value & 0x000000FF) >>  0;
-	fwrite(OutData, 0x04, 1, outfile);
+	return;
+}
+
+static void WriteBE32(UINT8* data, UINT32 Value)
+{
+	data[0x00] = (Value & 0xFF000000) >> 24;
+	data[0x01] = (Value & 0x00FF0000) >> 16;
+	data[0x02] = (Value & 0x0000FF00) >>  8;
+	data[0x03] = (Value & 0x000000FF) >>  0;
 	
 	return;
 }
 
-static void WriteMidiValue(FILE* outfile, UINT32 Value)
+static void WriteMidiValue(std::vector<UINT8>& buffer, UINT32 Value)
 {
 	UINT8 ValSize;
 	UINT8 ValData[0x05];	// 32-bit -> 5 7-bit groups (1 * 4-bit + 4 * 7-bit)
-	UINT32 TempLng;
-	UINT32 CurPos;
+	UINT8 CurPos;
 	
-	ValSize = 0x00;
-	TempLng = Value;
-	do
+	if (Value < 0x80)
 	{
-		TempLng >>= 7;
-		ValSize ++;
-	} while(TempLng);
+		buffer.push_back((UINT8)Value);	// most delays fit into a single byte
+		return;
+	}
 	
-	CurPos = ValSize;
-	TempLng = Value;
-	do
-	{
-		CurPos --;
-		ValData[CurPos] = 0x80 | (TempLng & 0x7F);
-		TempLng >>= 7;
-	} while(TempLng);
+	if (Value < 0x4000)
+		ValSize = 0x02;
+	else if (Value < 0x200000)
+		ValSize = 0x03;
+	else if (Value < 0x10000000)
+		ValSize = 0x04;
+	else
+		ValSize = 0x05;
+	for (CurPos = 0x00; CurPos < ValSize; CurPos ++)
+		ValData[CurPos] = 0x80 | ((Value >> (7 * (ValSize - 1 - CurPos))) & 0x7F);
 	ValData[ValSize - 1] &= 0x7F;
-	fwrite(ValData, 1, ValSize, outfile);
+	buffer.insert(buffer.end(), ValData, ValData + ValSize);
+	
+	return;
+}
+
+static void WriteMidiEvent(std::vector<UINT8>& buffer, const MidiEvent& evt, UINT32 delay, UINT8* lastEvt, bool compact)
+{
+	UINT8 evtType;
+	UINT8 evtValB;
+	
+	WriteMidiValue(buffer, delay);
+	
+	evtType = evt.evtType;
+	evtValB = evt.evtValB;
+	if (evtType < 0xF0)
+	{
+		if (compact)
+		{
+			// Note On with velocity 0 equals Note Off with velocity 64, use it to continue the Running Status
+			if ((evtType & 0xF0) == 0x80 && *lastEvt == (evtType | 0x10) && evtValB == 0x40)
+			{
+				evtType |= 0x10;
+				evtValB = 0x00;
+			}
+			if (*lastEvt != evtType)
+				buffer.push_back(evtType);
+		}
+		else
+		{
+			if (! evt.rsUse || *lastEvt != evtType)
+				buffer.push_back(evtType);
+		}
+	}
+	switch(evtType & 0xF0)
+	{
+	case 0x80:
+	case 0x90:
+	case 0xA0:
+	case 0xB0:
+	case 0xE0:
+		buffer.push_back(evt.evtValA);
+		buffer.push_back(evtValB);
+		break;
+	case 0xC0:
+	case 0xD0:
+		buffer.push_back(evt.evtValA);
+		break;
+	case 0xF0:
+		buffer.push_back(evtType);
+		switch(evtType)
+		{
+		case 0xFF:
+			buffer.push_back(evt.evtValA);
+			// fall through
+		case 0xF0:
+		case 0xF7:
+			WriteMidiValue(buffer, evt.evtData.size());
+			buffer.insert(buffer.end(), evt.evtData.begin(), evt.evtData.end());
+			break;
+		}
+	}
+	*lastEvt = evtType;
 	
 	return;
 }
@@ -3,24 +3,256 @@
 
 #include <stdtype.h>
 
-#include <list>
 #include <vector>
+#include <iterator>
+#include <stddef.h>	// for ptrdiff_t
 #include <stdio.h>	// for FILE
 
+// Monotonic memory pool: memory is taken from big blocks and only returned all at once,
+// so that loading a file doesn't need an allocation for each SysEx/Meta event.
+// Note: An arena must be used by a single thread at a time.
+class MidiArena
+{
+private:
+	struct Block
+	{
+		UINT8* data;
+		size_t size;
+	};
+	std::vector<Block> _blocks;	// the first block is kept by Reset()
+	std::vector<UINT8*> _bigAllocs;	// allocations that don't fit into a block
+	size_t _nextSize;	// size of the next block
+	UINT8* _curPtr;
+	size_t _curFree;
+	
+	MidiArena(const MidiArena&);	// not copyable
+	MidiArena& operator=(const MidiArena&);
+	
+public:
+	MidiArena(void);
+	~MidiArena();
+	
+	// returns NULL if there is no memory left
+	void* Alloc(size_t size);
+	// frees all memory except for the first block, which is reused
+	void Reset(void);
+};
+
+// Data of SysEx and Meta events.
+// It keeps only a single pointer in the event, as most events (channel events) have no data.
+// The data can also reference external memory (e.g. a memory-mapped file).
+// Such a reference is turned into a private copy on the first non-const access.
+// The interface is a subset of std::vector<UINT8>.
+class MidiEvtData
+{
+private:
+	struct DataHdr
+	{
+		UINT32 size;
+		bool inArena;	// the header (and data) belongs to a MidiArena and must not be freed
+		const UINT8* ptr;	// points to the data following the header or to external memory
+	};
+	DataHdr* _hdr;	// NULL = no data
+	
+	bool IsRef(void) const	{ return _hdr->ptr != reinterpret_cast<const UINT8*>(_hdr + 1); }
+	UINT8* GetWritePtr(void);
+	void Detach(void);
+	static DataHdr* AllocHdr(size_t dataSize, MidiArena* arena);
+	static void FreeHdr(DataHdr* hdr);
+	
+public:
+	MidiEvtData(void) : _hdr(NULL) {}
+	MidiEvtData(const MidiEvtData& src);
+	~MidiEvtData();
+	MidiEvtData& operator=(const MidiEvtData& src);
+	
+	size_t size(void) const	{ return (_hdr != NULL) ? _hdr->size : 0; }
+	bool empty(void) const	{ return _hdr == NULL; }
+	UINT8* data(void)	{ return (_hdr != NULL) ? GetWritePtr() : NULL; }
+	const UINT8* data(void) const	{ return (_hdr != NULL) ? _hdr->ptr : NULL; }
+	UINT8& operator[](size_t idx)	{ return data()[idx]; }
+	const UINT8& operator[](size_t idx) const	{ return _hdr->ptr[idx]; }
+	UINT8* begin(void)	{ return data(); }
+	UINT8* end(void)	{ return data() + size(); }
+	const UINT8* begin(void) const	{ return data(); }
+	const UINT8* end(void) const	{ return data() + size(); }
+	
+	void clear(void);
+	void resize(size_t newSize);
+	// arena (optional): take the memory from the arena instead of the heap
+	// Note: The arena must stay valid until the data is modified or deleted, like referenced data.
+	void assign(const UINT8* first, const UINT8* last, MidiArena* arena = NULL);
+	void swap(MidiEvtData& other);
+	// reference external data instead of copying it
+	// Note: The data must stay valid until the event is modified or deleted.
+	void assign_ref(const UINT8* first, const UINT8* last, MidiArena* arena = NULL);
+	bool is_ref(void) const	{ return _hdr != NULL && IsRef(); }
+};
+
+// The first 8 bytes hold everything a channel event needs, SysEx/Meta data is stored out-of-line.
 struct MidiEvent
 {
 	UINT32 tick;
-	bool rsUse;	// use Running Status to shorten event
 	UINT8 evtType;
 	UINT8 evtValA;	// Note Height, Controller Type, ...
 	UINT8 evtValB;
-	std::vector<UINT8> evtData;
+	bool rsUse;	// use Running Status to shorten event
+	MidiEvtData evtData;
+};
+
+class MidiEditBatch;
+
+// Event list with a std::list-like interface.
+// All events are stored in a single contiguous pool and linked via node indices,
+// so iterators stay valid when other events are inserted or removed.
+class MidiEvtList
+{
+private:
+	struct EvtNode
+	{
+		UINT32 prev;
+		UINT32 next;
+		MidiEvent evt;
+	};
+	std::vector<EvtNode> _nodes;	// node 0 is the list head and acts as end()
+	UINT32 _freeNode;	// first node of the list of unused nodes (0 = none)
+	UINT32 _count;
+	// tick index: sparse "checkpoint" nodes, in list order (which implies ascending ticks)
+	// It is filled by lower_bound() and stays valid when events are inserted or removed.
+	// Changing the tick of an event in place makes it stale, see ticks_changed().
+	std::vector<UINT32> _tickIdx;
+	
+	UINT32 AllocNode(const MidiEvent& evt);
+	UINT32 AllocNode(MidiEvent& evt, bool move);
+	void FreeNode(UINT32 node);
+	void GrowPool(size_t minCount);
+	void LinkNode(UINT32 node, UINT32 nextNode);
+	void UnlinkNode(UINT32 node);
+	void RemoveTickIdxNode(UINT32 node);
+	static void MoveNodeEvent(MidiEvent& dst, MidiEvent& src);
+	
+public:
+	class const_iterator;
+	class iterator
+	{
+		friend class MidiEvtList;
+		friend class const_iterator;
+	private:
+		MidiEvtList* _list;
+		UINT32 _node;
+		iterator(MidiEvtList* list, UINT32 node) : _list(list), _node(node) {}
+	public:
+		typedef std::bidirectional_iterator_tag iterator_category;
+		typedef MidiEvent value_type;
+		typedef ptrdiff_t difference_type;
+		typedef MidiEvent* pointer;
+		typedef MidiEvent& reference;
+		
+		iterator(void) : _list(NULL), _node(0) {}
+		MidiEvent& operator*(void) const	{ return _list->_nodes[_node].evt; }
+		MidiEvent* operator->(void) const	{ return &_list->_nodes[_node].evt; }
+		iterator& operator++(void)	{ _node = _list->_nodes[_node].next; return *this; }
+		iterator& operator--(void)	{ _node = _list->_nodes[_node].prev; return *this; }
+		iterator operator++(int)	{ iterator it(*this); ++*this; return it; }
+		iterator operator--(int)	{ iterator it(*this); --*this; return it; }
+		bool operator==(const iterator& it) const	{ return _node == it._node && _list == it._list; }
+		bool operator!=(const iterator& it) const	{ return ! (*this == it); }
+	};
+	class const_iterator
+	{
+		friend class MidiEvtList;
+	private:
+		const MidiEvtList* _list;
+		UINT32 _node;
+		const_iterator(const MidiEvtList* list, UINT32 node) : _list(list), _node(node) {}
+	public:
+		typedef std::bidirectional_iterator_tag iterator_category;
+		typedef MidiEvent value_type;
+		typedef ptrdiff_t difference_type;
+		typedef const MidiEvent* pointer;
+		typedef const MidiEvent& reference;
+		
+		const_iterator(void) : _list(NULL), _node(0) {}
+		const_iterator(const iterator& it) : _list(it._list), _node(it._node) {}
+		const MidiEvent& operator*(void) const	{ return _list->_nodes[_node].evt; }
+		const MidiEvent* operator->(void) const	{ return &_list->_nodes[_node].evt; }
+		const_iterator& operator++(void)	{ _node = _list->_nodes[_node].next; return *this; }
+		const_iterator& operator--(void)	{ _node = _list->_nodes[_node].prev; return *this; }
+		const_iterator operator++(int)	{ const_iterator it(*this); ++*this; return it; }
+		const_iterator operator--(int)	{ const_iterator it(*this); --*this; return it; }
+		bool operator==(const const_iterator& it) const	{ return _node == it._node && _list == it._list; }
+		bool operator!=(const const_iterator& it) const	{ return ! (*this == it); }
+	};
+	
+	MidiEvtList(void);
+	
+	size_t size(void) const	{ return _count; }
+	bool empty(void) const	{ return ! _count; }
+	void reserve(size_t count);
+	void clear(void);
+	
+	iterator begin(void)	{ return iterator(this, _nodes[0].next); }
+	iterator end(void)	{ return iterator(this, 0); }
+	const_iterator begin(void) const	{ return const_iterator(this, _nodes[0].next); }
+	const_iterator end(void) const	{ return const_iterator(this, 0); }
+	MidiEvent& front(void)	{ return _nodes[_nodes[0].next].evt; }
+	MidiEvent& back(void)	{ return _nodes[_nodes[0].prev].evt; }
+	const MidiEvent& front(void) const	{ return _nodes[_nodes[0].next].evt; }
+	const MidiEvent& back(void) const	{ return _nodes[_nodes[0].prev].evt; }
+	
+	void push_back(const MidiEvent& evt);
+	void push_front(const MidiEvent& evt);
+	iterator insert(iterator pos, const MidiEvent& evt);
+	// moves the data of evt into the new event instead of copying it, evt is left without data
+	// Note: evt must not be part of this list.
+	iterator insert_move(iterator pos, MidiEvent& evt);
+	iterator erase(iterator pos);
+	// moves the event srcIt of src (which may be this list) before pos, returns its new position
+	// The event data is not copied.
+	iterator splice(iterator pos, MidiEvtList& src, iterator srcIt);
+	
+	// returns the first event whose tick is >= the given tick
+	// Note: Events must be sorted by tick.
+	iterator lower_bound(UINT32 tick);
+	// sets the tick of every event to round(tick * mul / div)
+	void scale_ticks(UINT32 mul, UINT32 div);
+	// drops the tick index, must be called after changing the tick of events via an iterator
+	void ticks_changed(void);
+	
+	// rebuilds the list with all edits applied in a single pass, invalidates all iterators
+	void apply_edits(MidiEditBatch& edits);
 };
 
-typedef std::list<MidiEvent> MidiEvtList;
 typedef MidiEvtList::iterator midevt_iterator;
 typedef MidiEvtList::const_iterator midevt_const_it;
 
+// Collects edits of a track, so that they can be applied together by MidiTrack::ApplyEdits().
+// All positions refer to the events before the edits, so iterators stay valid while recording.
+// Each event may be moved or removed only once per batch.
+class MidiEditBatch
+{
+private:
+	struct EditPlace
+	{
+		midevt_iterator pos;	// the event is placed before this one
+		midevt_iterator evt;	// event to be moved (only used when newEvt is -1)
+		size_t newEvt;	// index into _newEvts
+	};
+	std::vector<EditPlace> _places;
+	std::vector<midevt_iterator> _removed;
+	std::vector<MidiEvent> _newEvts;
+	
+	friend class MidiEvtList;
+	
+public:
+	// Note: Events placed before the same position keep the order they were added in.
+	void Insert(midevt_iterator pos, const MidiEvent& evt);
+	void Move(midevt_iterator pos, midevt_iterator evtIt);
+	void Remove(midevt_iterator evtIt);
+	void Clear(void);
+	bool IsEmpty(void) const;
+};
+
 class MidiTrack
 {
 public:
@@ -31,9 +263,13 @@ public:
 	UINT32 GetEventCount(void) const;
 	UINT32 GetTickCount(void) const;
 	const MidiEvtList& GetEvents(void) const;
+	// Note: The events must stay sorted by tick. After changing the "tick" of events
+	//       via these iterators, call TicksChanged() before the next tick lookup
+	//       (GetEventFromTick(), InsertEventT(), MoveEventTo()).
 	midevt_iterator GetEventBegin(void);
 	midevt_iterator GetEventEnd(void);
 	midevt_iterator GetEventFromTick(UINT32 tick);
+	void TicksChanged(void);
 	
 	static INT16 GetPitchBendValue(UINT8 valLSB, UINT8 valMSB);
 	static INT16 GetPitchBendValue(const MidiEvent& evt);
@@ -65,14 +301,34 @@ public:
 	void InsertMetaEventD(midevt_iterator prevEvt, UINT32 Delay, UINT8 Type, UINT32 DataLen, const void* Data);
 	
 	void RemoveEvent(midevt_iterator evtIt);
+	// Moves the event to the track dst (behind all events with the same tick) without copying its data.
+	// Returns the event that followed evtIt in this track.
+	midevt_iterator MoveEventTo(MidiTrack& dst, midevt_iterator evtIt);
+	// rescales all ticks by mul/div, rounded to the nearest tick
+	void ScaleTicks(UINT32 mul, UINT32 div);
+	// applies and clears the batch, all iterators of the track become invalid
+	void ApplyEdits(MidiEditBatch& edits);
 	
 	UINT8 ReadFromFile(FILE* infile);
-	UINT8 WriteToFile(FILE* outfile) const;
+	// BufData points to the "MTrk" chunk header, RetChunkSize (optional) returns the number of bytes used
+	// refData = true: SysEx/Meta events reference BufData instead of copying it
+	// arena (optional): SysEx/Meta data is allocated from the arena
+	// Returns 0xFF when running out of memory.
+	UINT8 ReadFromBuffer(UINT32 BufLen, const UINT8* BufData, UINT32* RetChunkSize, bool refData, MidiArena* arena = NULL);
+	// compact = true: ignore rsUse and write the shortest possible byte stream (see MidiFile::SetCompactOutput)
+	UINT8 WriteToFile(FILE* outfile, bool compact = false) const;
+	// appends the whole "MTrk" chunk to Buffer
+	UINT8 WriteToBuffer(std::vector<UINT8>& Buffer, bool compact = false) const;
 	
 private:
 	MidiEvtList _events;
 	
+	friend class MidiFile;	// ConvertMidiFormat() moves events into a new track
 	midevt_iterator GetFirstEventAtTick(UINT32 Tick);
+	// The Move functions take over the data of Event instead of copying it.
+	void AppendEventMove(MidiEvent& Event);
+	void InsertEventTMove(MidiEvent& Event);
+	void InsertEventDMove(midevt_iterator prevEvt, MidiEvent& Event);
 };
 
 class MidiFile
@@ -82,19 +338,40 @@ private:
 	//UINT16 _trackCount;
 	UINT16 _resolution;
 	std::vector<MidiTrack*> _tracks;
+	UINT8* _mapData;	// memory-mapped input file, referenced by SysEx/Meta events
+	UINT32 _mapSize;
+	bool _compact;
+	// SysEx/Meta data of loaded files, one arena per track so that tracks can be loaded concurrently
+	// ClearAll() passes the arenas to a per-thread cache, so that a thread that processes many files
+	// (e.g. a batch worker) reuses them for the next file.
+	std::vector<MidiArena*> _arenas;
+	
+	UINT8 LoadBuffer(UINT32 FileLen, const UINT8* FileData, bool refData);
+	// Chunks[0] receives the header, Chunks[1+n] track n
+	UINT8 EncodeChunks(std::vector< std::vector<UINT8> >& Chunks) const;
 	
 public:
 	MidiFile(void);
 	~MidiFile();
 	void ClearAll(void);
 	
+	// Note: The SysEx/Meta data of loaded events belongs to the MidiFile until it is modified.
+	//       Copied events get their own data and are always safe. Data that is swapped into another file
+	//       (e.g. by MidiTrack::MoveEventTo) is only valid until ClearAll().
 	UINT8 LoadFile(const char* fileName);
 	UINT8 LoadFile(FILE* infile);
-	//UINT8 LoadFile(UINT32 FileLen, UINT8* FileData);
+	UINT8 LoadFile(UINT32 FileLen, const UINT8* FileData);
+	// Maps the file into memory instead of reading it. SysEx/Meta data is not copied, but references
+	// the mapped file until it is modified. The file stays mapped until ClearAll() is called.
+	UINT8 LoadFileMapped(const char* fileName);
 	
 	UINT8 SaveFile(const char* fileName);
 	UINT8 SaveFile(FILE* outfile);
-	//UINT8 SaveFile(UINT32* RetFileSize, UINT8** RetFileData);
+	// Note: The returned data is allocated with malloc() and must be freed by the caller.
+	UINT8 SaveFile(UINT32* RetFileSize, UINT8** RetFileData);
+	// Compact output uses Running Status wherever possible (instead of keeping the original status bytes)
+	// and writes Note Off events with release velocity 64 as Note On with velocity 0, if that saves a status byte.
+	void SetCompactOutput(bool compact);
 	
 	UINT16 GetMidiFormat(void) const;
 	UINT16 GetMidiResolution(void) const;
@@ -103,8 +380,12 @@ public:
 	
 	UINT8 SetMidiFormat(UINT16 newFormat);
 	UINT8 SetMidiResolution(UINT16 newResolution);
-	//UINT8 ConvertMidiFormat(UINT16 newFormat);	// maybe later
-	//UINT8 ConvertMidiResolution(UINT16 newResolution);	// maybe later
+	// Format 0 merges all tracks into a single one, with a single End-Of-Track event.
+	// Events at the same tick are sorted by their track number.
+	UINT8 ConvertMidiFormat(UINT16 newFormat);
+	// Rescales the ticks of all events to the new resolution.
+	// Returns 0x01 (and changes nothing) if the ticks would overflow.
+	UINT8 ConvertMidiResolution(UINT16 newResolution);
 	
 	MidiTrack* NewTrack_Append(void);
 	MidiTrack* NewTrack_Insert(UINT16 newTrackID);
@@ -116,4 +397,128 @@ public:
 	UINT8 DeleteTrack(UINT16 trackID);
 };
 
+// Converts between ticks and real time, using the Set Tempo (FF 51) events of all tracks.
+// The time of each tempo change is precalculated, so that each query is a binary search.
+class MidiTempoMap
+{
+private:
+	struct TempoChg
+	{
+		UINT32 tick;
+		UINT32 tempo;	// microseconds per quarter
+		UINT64 tmrTick;	// time at tick, in microseconds * _tickDiv (keeps the sum exact)
+	};
+	std::vector<TempoChg> _tempos;	// sorted by tick, the first entry is always at tick 0
+	UINT32 _tickDiv;	// ticks per quarter (or per second for SMPTE timing)
+	
+	static bool TempoChgLess(const TempoChg& first, const TempoChg& second);
+	size_t FindTick(UINT32 tick) const;
+	size_t FindTime(UINT64 tmrTick) const;
+	UINT64 TickToTime(size_t idx, UINT32 tick) const;
+	UINT32 TimeToTick(size_t idx, UINT64 tmrTick) const;
+	
+public:
+	MidiTempoMap(void);
+	
+	void Build(MidiFile& midFile);
+	void Clear(void);
+	size_t GetTempoCount(void) const;
+	
+	UINT64 Tick2Usec(UINT32 tick) const;
+	UINT32 Usec2Tick(UINT64 usec) const;
+	// batch conversion, ascending values are processed in linear time
+	void Tick2Usec(size_t count, const UINT32* ticks, UINT64* usecs) const;
+	void Usec2Tick(size_t count, const UINT64* usecs, UINT32* ticks) const;
+};
+
+// Reads the events of a MIDI file one by one, without building MidiTrack lists.
+// SysEx/Meta data references the input data and stays valid until Close() is called.
+class MidiEvtReader
+{
+private:
+	UINT8* _mapData;	// memory-mapped input file (only used by OpenFile)
+	UINT32 _mapSize;
+	const UINT8* _fileData;
+	UINT32 _fileLen;
+	UINT16 _format;
+	UINT16 _trkCnt;
+	UINT16 _resolution;
+	UINT16 _curTrk;	// number of tracks entered so far
+	UINT32 _chunkPos;	// start of the next chunk
+	UINT32 _curPos;
+	UINT32 _trkEnd;
+	UINT32 _curTick;
+	UINT8 _lastEvt;
+	UINT32 _evtPos;	// file offset of the last event (after its delay)
+	bool _writable;
+	
+public:
+	MidiEvtReader(void);
+	~MidiEvtReader();
+	
+	// writable = true: the file is mapped for writing, so that PatchData() can modify it
+	UINT8 OpenFile(const char* fileName, bool writable = false);
+	// Note: The data must stay valid until Close() is called.
+	UINT8 OpenBuffer(UINT32 FileLen, const UINT8* FileData);
+	void Close(void);
+	
+	UINT16 GetMidiFormat(void) const;
+	UINT16 GetMidiResolution(void) const;
+	UINT16 GetTrackCount(void) const;
+	
+	// enters the next "MTrk" chunk, returns 0x00 on success
+	UINT8 NextTrack(void);
+	// returns 0x00 when an event was read and 0xFF at the end of the track
+	UINT8 ReadEvent(MidiEvent& evt);
+	// file offset and size of the last event, excluding the delay and Running Status
+	UINT32 GetEventOffset(void) const;
+	UINT32 GetEventSize(void) const;
+	
+	// overwrites a single byte of a file opened as writable
+	UINT8 PatchData(UINT32 offset, UINT8 value);
+};
+
+// Writes a MIDI file event by event, so that only a small buffer is kept in memory.
+// The chunk sizes and the track count are patched in when the track/file is finished.
+class MidiEvtWriter
+{
+private:
+	FILE* _hFile;
+	std::vector<UINT8> _buffer;
+	long _trkPos;	// file offset of the current track's data (0 = no track open)
+	UINT16 _trkCnt;
+	UINT32 _curTick;
+	UINT8 _lastEvt;
+	bool _compact;
+	
+	UINT8 FlushBuffer(void);
+	
+public:
+	MidiEvtWriter(void);
+	~MidiEvtWriter();
+	
+	// compact = true: write the shortest possible byte stream (see MidiFile::SetCompactOutput)
+	UINT8 OpenFile(const char* fileName, UINT16 format, UINT16 resolution, bool compact = false);
+	UINT8 Close(void);
+	
+	UINT8 BeginTrack(void);
+	// Note: The event ticks are absolute and must not decrease within a track.
+	UINT8 WriteEvent(const MidiEvent& evt);
+	UINT8 EndTrack(void);
+};
+
+typedef void (*PARALLEL_FUNC)(void* userData, size_t index);
+// calls func for all indices [0, count) using a pool of worker threads
+// maxThreads = 0: use one thread per CPU
+// Note: Nested calls (from within func) are processed by the calling thread only.
+void RunParallel(size_t count, PARALLEL_FUNC func, void* userData, UINT32 maxThreads);
+
+// returns the number of successful event-data/pool allocations that MidiLib did
+// (event data, arena blocks and event pools - not the track objects, file buffers or containers)
+// on the calling thread, including the RunParallel() jobs started by it
+UINT32 GetAllocCount(void);
+
+// returns true if both names refer to the same existing file (e.g. "a.mid" and "./a.mid")
+bool IsSameFile(const char* fileName1, const char* fileName2);
+
 #endif	// __MIDILIB_HPP__
@@ -0,0 +1,859 @@
+// Track splitting of the Midi Splitter
+#include <string>
+#include <vector>
+#include <list>
+#include <algorithm>
+#include <cstring>
+#include <stdio.h>
+#include "MidiLib.hpp"
+#include "MidiSpltLib.hpp"
+
+#define SPLIT_PARALLEL_MIN	0x4000	// files with fewer events are split by a single thread
+
+
+struct TrackInfo
+{
+	MidiTrack* midTrk;
+	std::string desc;	// track description
+	UINT32 id;	// position in the track list
+	
+	// split by note
+	UINT8 notePlaying[0x10];	// stores Note Height of currently playing note
+};
+
+typedef std::list<TrackInfo>::iterator trkinf_iterator;
+
+struct ActiveNote
+{
+	UINT32 tick;	// start tick
+	trkinf_iterator trkIt;	// track of the Note On event
+};
+// playing notes of a single channel/key, in the order of their Note On events
+struct NoteQueue
+{
+	std::vector<ActiveNote> notes;
+	size_t first;	// index of the first note that is still playing
+};
+struct TrackSplit
+{
+	std::list<TrackInfo> trkList;
+	std::vector<NoteQueue> activeNotes;	// index: (channel << 7) | key
+};
+struct SplitJob
+{
+	TrackSplit* trkSplt;	// one per source track
+	UINT8 spltMode;
+};
+
+
+// split IDs are the byte values an event is split by (channel, instrument, velocity or key)
+#define SPLIT_IDS	0x100
+struct SplitRouter
+{
+	bool idUsed[SPLIT_IDS];
+	trkinf_iterator idTrk[SPLIT_IDS];	// split ID -> track, unused IDs go to the source track
+};
+
+// voice tracks of the chord splitter
+struct ChordVoices
+{
+	std::vector<trkinf_iterator> trks;	// voice (= TrackInfo::id) -> track
+	std::vector<UINT32> freeMask[0x10];	// per channel: bit n set = voice n has no note playing
+};
+
+typedef void (*FuncSplitTrkInit)(TrackInfo& trk, int id);
+
+// Function Prototypes
+static void InitSplitRouter(SplitRouter& router);
+static void PrepareSplitTrackList(TrackSplit& trkSplt, SplitRouter& router, bool descending,
+									FuncSplitTrkInit funcTrackInit);
+// split chords
+static UINT8 FindFirstBit(UINT32 value);
+static void ChordSplt_AddVoice(ChordVoices& voices, trkinf_iterator trkIt);
+static void ChordSplt_SetVoiceFree(ChordVoices& voices, UINT32 voice, UINT8 chn, bool isFree);
+static trkinf_iterator ChordSplt_GetNoteOnTrk(TrackSplit& trkSplt, ChordVoices& voices, midevt_iterator midEvt);
+static void TrkSplit_Chord(TrackSplit& trkSplt);
+// split by instrument
+static void TrkInit_InsSplit(TrackInfo& trk, int id);
+static void TrkSplit_Instrument(TrackSplit& trkSplt);
+// split by channel
+static void TrkInit_ChnSplit(TrackInfo& trk, int id);
+static void TrkSplit_Channel(TrackSplit& trkSplt);
+// split by volume
+static void TrkInit_VelSplit(TrackInfo& trk, int id);
+static void TrkSplit_Velocity(TrackSplit& trkSplt);
+// split by key
+static void TrkInit_KeySplit(TrackInfo& trk, int id);
+static void TrkSplit_Key(TrackSplit& trkSplt);
+// general
+static UINT8 CountDigits(UINT32 value);
+static void ModifyTrackNames(std::list<TrackInfo>& trkLst, UINT16 midiTrkID);
+static void AddNoteToList(TrackSplit& trkSplt, trkinf_iterator trkIt, const MidiEvent& midEvt);
+static trkinf_iterator RemoveNoteFromList(TrackSplit& trkSplt, midevt_iterator midEvt);
+static void SplitTrackFunc(void* userData, size_t index);
+
+
+static void InitSplitRouter(SplitRouter& router)
+{
+	UINT16 curID;
+	
+	for (curID = 0; curID < SPLIT_IDS; curID ++)
+		router.idUsed[curID] = false;
+	
+	return;
+}
+
+// creates one track per used ID, in ascending (or descending) order of the IDs
+static void PrepareSplitTrackList(TrackSplit& trkSplt, SplitRouter& router, bool descending,
+									FuncSplitTrkInit funcTrackInit)
+{
+	size_t trkId;
+	trkinf_iterator trkIt;
+	UINT16 curID;
+	
+	// 1. used IDs -> sorted list of IDs
+	std::vector<UINT8> idList;
+	
+	for (curID = 0; curID < SPLIT_IDS; curID ++)
+	{
+		if (router.idUsed[curID])
+			idList.push_back((UINT8)curID);
+	}
+	if (descending)
+		std::reverse(idList.begin(), idList.end());
+	
+	// 2. create additional tracks
+	// Track with ID 0 already exists.
+	for (trkId = 1; trkId < idList.size(); trkId ++)
+	{
+		trkSplt.trkList.push_back(TrackInfo());
+		trkIt = trkSplt.trkList.end();
+		--trkIt;	// go to last track
+		trkIt->midTrk = new MidiTrack;
+		
+		trkIt->desc = "";
+		trkIt->id = (UINT32)trkId;
+	}
+	
+	// 3. create ID -> track lookup table, set track descriptions (funcTrackInit)
+	for (curID = 0; curID < SPLIT_IDS; curID ++)
+		router.idTrk[curID] = trkSplt.trkList.begin();
+	for (trkId = 0, trkIt = trkSplt.trkList.begin(); trkId < idList.size() && trkIt != trkSplt.trkList.end(); ++trkId, ++trkIt)
+	{
+		router.idTrk[idList[trkId]] = trkIt;
+		funcTrackInit(*trkIt, idList[trkId]);
+	}
+	
+	return;
+}
+
+// --- Functions for "Split Chords" ---
+// returns the index of the lowest set bit, value must not be 0
+static UINT8 FindFirstBit(UINT32 value)
+{
+	// De Bruijn sequence lookup, as there is no portable intrinsic for this
+	static const UINT8 DEBRUIJN_POS[0x20] =
+	{
+		 0,  1, 28,  2, 29, 14, 24,  3, 30, 22, 20, 15, 25, 17,  4,  8,
+		31, 27, 13, 23, 21, 19, 16,  7, 26, 12, 18,  6, 11,  5, 10,  9,
+	};
+	return DEBRUIJN_POS[((value & (0 - value)) * 0x077CB531U) >> 27];
+}
+
+static void ChordSplt_AddVoice(ChordVoices& voices, trkinf_iterator trkIt)
+{
+	UINT32 voice = (UINT32)voices.trks.size();
+	UINT8 curChn;
+	
+	voices.trks.push_back(trkIt);
+	for (curChn = 0x00; curChn < 0x10; curChn ++)
+	{
+		if (voices.freeMask[curChn].size() <= voice / 32)
+			voices.freeMask[curChn].push_back(0);
+		ChordSplt_SetVoiceFree(voices, voice, curChn, true);
+	}
+	
+	return;
+}
+
+static void ChordSplt_SetVoiceFree(ChordVoices& voices, UINT32 voice, UINT8 chn, bool isFree)
+{
+	UINT32& maskWord = voices.freeMask[chn][voice / 32];
+	
+	if (isFree)
+		maskWord |= (1U << (voice % 32));
+	else
+		maskWord &= ~(1U << (voice % 32));
+	
+	return;
+}
+
+static trkinf_iterator ChordSplt_GetNoteOnTrk(TrackSplit& trkSplt, ChordVoices& voices, midevt_iterator midEvt)
+{
+	std::list<TrackInfo>& trkLst = trkSplt.trkList;
+	trkinf_iterator trkIt;
+	UINT8 midChn = midEvt->evtType & 0x0F;
+	const std::vector<UINT32>& freeMask = voices.freeMask[midChn];
+	size_t curWord;
+	
+	// find the first free Track
+	for (curWord = 0; curWord < freeMask.size(); curWord ++)
+	{
+		if (freeMask[curWord])
+			return voices.trks[curWord * 32 + FindFirstBit(freeMask[curWord])];
+	}
+	
+	// no free track found - make new track and initialize notePlaying array
+	UINT8 curChn;
+	
+	trkLst.push_back(TrackInfo());
+	trkIt = trkLst.end();
+	--trkIt;
+	trkIt->midTrk = new MidiTrack;
+	
+	trkIt->desc = "";
+	trkIt->id = (UINT32)trkLst.size() - 1;
+	for (curChn = 0x00; curChn < 0x10; curChn ++)
+		trkIt->notePlaying[curChn] = 0xFF;
+	ChordSplt_AddVoice(voices, trkIt);
+	
+	return trkIt;
+}
+
+static void TrkSplit_Chord(TrackSplit& trkSplt)
+{
+	trkinf_iterator trkInfSrc;
+	MidiTrack* midTrk;
+	midevt_iterator evtIt;
+	ChordVoices voices;
+	UINT8 curChn;
+	
+	trkInfSrc = trkSplt.trkList.begin();
+	midTrk = trkInfSrc->midTrk;
+	for (curChn = 0x00; curChn < 0x10; curChn ++)
+		trkInfSrc->notePlaying[curChn] = 0xFF;
+	ChordSplt_AddVoice(voices, trkInfSrc);
+	
+	for (evtIt = midTrk->GetEventBegin(); evtIt != midTrk->GetEventEnd(); )
+	{
+		trkinf_iterator trkInfDst = trkInfSrc;
+		midevt_iterator curEvt = evtIt;
+		++evtIt;	// we may change the track of curEvt
+		
+		switch(curEvt->evtType & 0xF0)
+		{
+		case 0x80:
+		case 0x90:
+			curChn = curEvt->evtType & 0x0F;
+			if ((curEvt->evtType & 0xF0) == 0x90 && curEvt->evtValB > 0)
+			{
+				trkInfDst = ChordSplt_GetNoteOnTrk(trkSplt, voices, curEvt);
+				AddNoteToList(trkSplt, trkInfDst, *curEvt);
+				trkInfDst->notePlaying[curChn] = curEvt->evtValA;	// mark track/channel as "in use"
+				ChordSplt_SetVoiceFree(voices, trkInfDst->id, curChn, false);
+			}
+			else
+			{
+				trkinf_iterator noteOnTrk = RemoveNoteFromList(trkSplt, curEvt);
+				if (noteOnTrk != trkSplt.trkList.end())
+				{
+					noteOnTrk->notePlaying[curChn] = 0xFF;	// set 'no Note playing'
+					ChordSplt_SetVoiceFree(voices, noteOnTrk->id, curChn, true);
+					trkInfDst = noteOnTrk;	// move NoteOff event to track of NoteOn event
+				}
+			}
+			break;
+		}	// end switch(curEvt->Event & 0xF0)
+		
+		if (trkInfDst != trkInfSrc)
+		{
+			// move Event to current Track
+			midTrk->MoveEventTo(*trkInfDst->midTrk, curEvt);
+		}
+	}	// end for (evtIt)
+	
+	return;
+}
+
+// --- Functions for "Split by Instrument" ---
+static void TrkInit_InsSplit(TrackInfo& trk, int id)
+{
+	UINT8 ins = (UINT8)id;
+	{
+		char descBuf[0x10];
+		sprintf(descBuf, "ins %u", 1 + ins);
+		trk.desc = descBuf;
+	}
+	return;
+}
+
+static void TrkSplit_Instrument(TrackSplit& trkSplt)
+{
+	trkinf_iterator trkInfSrc;
+	trkinf_iterator trkInfChnDst[0x10];
+	MidiTrack* midTrk;
+	midevt_iterator evtIt;
+	UINT8 chnIns[0x10];
+	SplitRouter insRouter;
+	UINT8 curChn;
+	
+	// preparse to enumerate all instruments
+	midTrk = trkSplt.trkList.begin()->midTrk;
+	InitSplitRouter(insRouter);
+	for (curChn = 0x00; curChn < 0x10; curChn ++)
+		chnIns[curChn] = 0xFF;
+	for (evtIt = midTrk->GetEventBegin(); evtIt != midTrk->GetEventEnd(); ++evtIt)
+	{
+		switch(evtIt->evtType & 0xF0)
+		{
+		case 0x90:
+			curChn = evtIt->evtType & 0x0F;
+			if (evtIt->evtValB > 0 && chnIns[curChn] == 0xFF)
+			{
+				chnIns[curChn] = 0x00;
+				insRouter.idUsed[chnIns[curChn]] = true;
+			}
+			break;
+		case 0xC0:
+			curChn = evtIt->evtType & 0x0F;
+			chnIns[curChn] = evtIt->evtValA;
+			insRouter.idUsed[chnIns[curChn]] = true;
+			break;
+		}	// end switch(evtIt->evtType & 0xF0)
+	}	// end for (evtIt)
+	PrepareSplitTrackList(trkSplt, insRouter, false, TrkInit_InsSplit);
+	
+	// do actual splitting
+	trkInfSrc = trkSplt.trkList.begin();
+	midTrk = trkInfSrc->midTrk;
+	for (curChn = 0x00; curChn < 0x10; curChn ++)
+		trkInfChnDst[curChn] = trkInfSrc;
+	
+	for (evtIt = midTrk->GetEventBegin(); evtIt != midTrk->GetEventEnd(); )
+	{
+		trkinf_iterator trkInfDst;
+		midevt_iterator curEvt = evtIt;
+		++evtIt;	// we may change the track of curEvt
+		
+		if (curEvt->evtType >= 0xF0)	// don't move SysEx and Meta events
+		{
+			curChn = 0x00;
+			trkInfDst = trkInfSrc;
+		}
+		else	// move channel-specific instruments based on the channel's current instrument
+		{
+			curChn = curEvt->evtType & 0x0F;
+			trkInfDst = trkInfChnDst[curChn];
+		}
+		
+		switch(curEvt->evtType & 0xF0)
+		{
+		case 0x80:
+		case 0x90:
+			if ((curEvt->evtType & 0xF0) == 0x90 && curEvt->evtValB)
+			{
+				AddNoteToList(trkSplt, trkInfDst, *curEvt);
+			}
+			else
+			{
+				trkinf_iterator noteOnTrk = RemoveNoteFromList(trkSplt, curEvt);
+				if (noteOnTrk != trkSplt.trkList.end())
+					trkInfDst = noteOnTrk;	// move NoteOff event to track of NoteOn event
+			}
+			break;
+		case 0xC0:
+			trkInfDst = insRouter.idTrk[curEvt->evtValA];	// find a track that uses the new instrument
+			trkInfChnDst[curChn] = trkInfDst;
+			break;
+		}	// end switch(curEvt->evtType & 0xF0)
+		
+		if (trkInfDst != trkInfSrc)
+		{
+			// move Event to current Track
+			midTrk->MoveEventTo(*trkInfDst->midTrk, curEvt);
+		}
+	}	// end for (evtIt)
+	
+	return;
+}
+
+// --- Functions for "Split by Channel" ---
+static void TrkInit_ChnSplit(TrackInfo& trk, int id)
+{
+	UINT8 chn = (UINT8)id;
+	{
+		char descBuf[0x10];
+		sprintf(descBuf, "ch %u", 1 + chn);
+		trk.desc = descBuf;
+	}
+	return;
+}
+
+static void TrkSplit_Channel(TrackSplit& trkSplt)
+{
+	trkinf_iterator trkInfSrc;
+	MidiTrack* midTrk;
+	midevt_iterator evtIt;
+	SplitRouter chnRouter;
+	UINT8 curChn;
+	
+	// preparse to enumerate all instruments
+	midTrk = trkSplt.trkList.begin()->midTrk;
+	InitSplitRouter(chnRouter);
+	for (evtIt = midTrk->GetEventBegin(); evtIt != midTrk->GetEventEnd(); ++evtIt)
+	{
+		if (evtIt->evtType < 0xF0)
+		{
+			curChn = evtIt->evtType & 0x0F;
+			chnRouter.idUsed[curChn] = true;
+		}
+		else
+		{
+			if (evtIt->evtType == 0xFF && evtIt->evtValA == 0x20)
+			{
+				if (evtIt->evtData.size() >= 1)
+				{
+					curChn = evtIt->evtData[0x00] & 0x0F;
+					chnRouter.idUsed[curChn] = true;
+				}
+			}
+		}
+	}	// end for (evtIt)
+	PrepareSplitTrackList(trkSplt, chnRouter, false, TrkInit_ChnSplit);
+	
+	// do actual splitting
+	trkInfSrc = trkSplt.trkList.begin();
+	midTrk = trkInfSrc->midTrk;
+	
+	for (evtIt = midTrk->GetEventBegin(); evtIt != midTrk->GetEventEnd(); )
+	{
+		trkinf_iterator trkInfChnDst;
+		midevt_iterator curEvt = evtIt;
+		++evtIt;	// we may change the track of curEvt
+		
+		if (curEvt->evtType < 0xF0)
+		{
+			curChn = curEvt->evtType & 0x0F;
+		}
+		else
+		{
+			curChn = 0xFF;
+			if (curEvt->evtType == 0xFF && curEvt->evtValA == 0x20)
+			{
+				if (curEvt->evtData.size() >= 1)
+					curChn = curEvt->evtData[0x00] & 0x0F;
+			}
+		}
+		trkInfChnDst = chnRouter.idTrk[curChn];	// channel 0xFF is never used, so it stays on the source track
+		if (trkInfChnDst != trkInfSrc)
+		{
+			// move Event to current Track
+			midTrk->MoveEventTo(*trkInfChnDst->midTrk, curEvt);
+		}
+	}	// end for (evtIt)
+	
+	return;
+}
+
+// --- Functions for "Split by Volume" ---
+static void TrkInit_VelSplit(TrackInfo& trk, int id)
+{
+	UINT8 vel = (UINT8)id;
+	{
+		char descBuf[0x10];
+		sprintf(descBuf, "vol %u", vel);
+		trk.desc = descBuf;
+	}
+	return;
+}
+
+static void TrkSplit_Velocity(TrackSplit& trkSplt)
+{
+	trkinf_iterator trkInfSrc;
+	trkinf_iterator trkInfChnDst[0x10];
+	MidiTrack* midTrk;
+	midevt_iterator evtIt;
+	SplitRouter volRouter;
+	UINT8 curChn;
+	
+	// preparse to enumerate all volume values
+	midTrk = trkSplt.trkList.begin()->midTrk;
+	InitSplitRouter(volRouter);
+	for (evtIt = midTrk->GetEventBegin(); evtIt != midTrk->GetEventEnd(); ++evtIt)
+	{
+		switch(evtIt->evtType & 0xF0)
+		{
+		case 0x90:
+			if (evtIt->evtValB > 0)
+				volRouter.idUsed[evtIt->evtValB] = true;
+			break;
+		}	// end switch(evtIt->evtType & 0xF0)
+	}	// end for (evtIt)
+	PrepareSplitTrackList(trkSplt, volRouter, true, TrkInit_VelSplit);	// sort from high to low volume
+	
+	// do actual splitting
+	trkInfSrc = trkSplt.trkList.begin();
+	midTrk = trkInfSrc->midTrk;
+	for (curChn = 0x00; curChn < 0x10; curChn ++)
+		trkInfChnDst[curChn] = trkInfSrc;
+	
+	for (evtIt = midTrk->GetEventBegin(); evtIt != midTrk->GetEventEnd(); )
+	{
+		trkinf_iterator trkInfDst = trkInfSrc;
+		midevt_iterator curEvt = evtIt;
+		++evtIt;	// we may change the track of curEvt
+		
+		// TODO: Allow moving Control Change channel events as well.
+		switch(curEvt->evtType & 0xF0)
+		{
+		case 0x80:
+		case 0x90:
+			if ((curEvt->evtType & 0xF0) == 0x90 && curEvt->evtValB)
+			{
+				// Note On
+				trkInfDst = volRouter.idTrk[curEvt->evtValB];
+				AddNoteToList(trkSplt, trkInfDst, *curEvt);
+				
+				curChn = curEvt->evtType & 0x0F;
+				trkInfChnDst[curChn] = trkInfDst;
+			}
+			else
+			{
+				// Note Off
+				trkinf_iterator noteOnTrk = RemoveNoteFromList(trkSplt, curEvt);
+				if (noteOnTrk != trkSplt.trkList.end())
+					trkInfDst = noteOnTrk;	// move NoteOff event to track of NoteOn event
+			}
+			break;
+		case 0xB0:	// Control Change
+			switch(curEvt->evtValA)
+			{
+			case 0x07:	// Main Volume
+			case 0x0B:	// Expression
+				break;
+			}
+			break;
+		case 0xE0:	// Pitch Bend
+			// move pitch bends along with the note they are applied to
+			curChn = curEvt->evtType & 0x0F;
+			trkInfDst = trkInfChnDst[curChn];
+			break;
+		}
+		
+		if (trkInfDst != trkInfSrc)
+		{
+			// move Event to current Track
+			midTrk->MoveEventTo(*trkInfDst->midTrk, curEvt);
+		}
+	}	// end for (evtIt)
+	
+	return;
+}
+
+// --- Functions for "Split by Key" ---
+static void TrkInit_KeySplit(TrackInfo& trk, int id)
+{
+	UINT8 key = (UINT8)id;
+	{
+		char descBuf[0x10];
+		sprintf(descBuf, "note %u", key);
+		trk.desc = descBuf;
+	}
+	return;
+}
+
+static void TrkSplit_Key(TrackSplit& trkSplt)
+{
+	trkinf_iterator trkInfSrc;
+	trkinf_iterator trkInfChnDst[0x10];
+	MidiTrack* midTrk;
+	midevt_iterator evtIt;
+	SplitRouter keyRouter;
+	UINT8 curChn;
+	
+	// preparse to enumerate all key values
+	midTrk = trkSplt.trkList.begin()->midTrk;
+	InitSplitRouter(keyRouter);
+	for (evtIt = midTrk->GetEventBegin(); evtIt != midTrk->GetEventEnd(); ++evtIt)
+	{
+		switch(evtIt->evtType & 0xF0)
+		{
+		case 0x90:
+			if (evtIt->evtValB > 0)	// only conider Note On events
+				keyRouter.idUsed[evtIt->evtValA] = true;
+			break;
+		}	// end switch(evtIt->evtType & 0xF0)
+	}	// end for (evtIt)
+	PrepareSplitTrackList(trkSplt, keyRouter, false, TrkInit_KeySplit);
+	
+	// do actual splitting
+	trkInfSrc = trkSplt.trkList.begin();
+	midTrk = trkInfSrc->midTrk;
+	for (curChn = 0x00; curChn < 0x10; curChn ++)
+		trkInfChnDst[curChn] = trkInfSrc;
+	
+	for (evtIt = midTrk->GetEventBegin(); evtIt != midTrk->GetEventEnd(); )
+	{
+		trkinf_iterator trkInfDst = trkInfSrc;
+		midevt_iterator curEvt = evtIt;
+		++evtIt;	// we may change the track of curEvt
+		
+		// TODO: Allow moving Control Change channel events as well.
+		switch(curEvt->evtType & 0xF0)
+		{
+		case 0x80:
+		case 0x90:
+			if ((curEvt->evtType & 0xF0) == 0x90 && curEvt->evtValB)
+			{
+				// Note On
+				trkInfDst = keyRouter.idTrk[curEvt->evtValA];
+				AddNoteToList(trkSplt, trkInfDst, *curEvt);
+				
+				curChn = curEvt->evtType & 0x0F;
+				trkInfChnDst[curChn] = trkInfDst;
+			}
+			else
+			{
+				// Note Off
+				trkinf_iterator noteOnTrk = RemoveNoteFromList(trkSplt, curEvt);
+				if (noteOnTrk != trkSplt.trkList.end())
+					trkInfDst = noteOnTrk;	// move NoteOff event to track of NoteOn event
+			}
+			break;
+		case 0xE0:	// Pitch Bend
+			// move pitch bends along with the note they are applied to
+			curChn = curEvt->evtType & 0x0F;
+			trkInfDst = trkInfChnDst[curChn];
+			break;
+		}
+		
+		if (trkInfDst != trkInfSrc)
+		{
+			// move Event to current Track
+			midTrk->MoveEventTo(*trkInfDst->midTrk, curEvt);
+		}
+	}	// end for (evtIt)
+	
+	return;
+}
+
+
+// --- General Functions ---
+static UINT8 CountDigits(UINT32 value)
+{
+	UINT8 digits;
+	
+	digits = 0;
+	do
+	{
+		digits ++;
+		value /= 10;
+	} while(value);
+	
+	return digits;
+}
+
+static std::string GenerateTkName(const std::string& trkName, UINT16 trkID)
+{
+	if (! trkName.empty())
+		return trkName;
+	
+	char nameBuf[0x10];
+	sprintf(nameBuf, "tk%u", trkID);
+	return std::string(nameBuf);
+}
+
+static void ModifyTrackNames(std::list<TrackInfo>& trkLst, UINT16 midiTrkID)
+{
+	if (trkLst.size() <= 1)
+		return;
+	
+	trkinf_iterator trkIt;
+	MidiTrack* mainMTrk;
+	midevt_iterator evtIt;
+	midevt_iterator tNameEvtIt;
+	UINT16 trkID;
+	UINT16 trkNums;	// Width of TrkCount
+	std::string trkName;
+	
+	trkNums = CountDigits(trkLst.size());
+	
+	trkName = std::string();
+	mainMTrk = trkLst.begin()->midTrk;
+	tNameEvtIt = mainMTrk->GetEventEnd();
+	for (evtIt = mainMTrk->GetEventBegin(); evtIt != mainMTrk->GetEventEnd(); ++evtIt)
+	{
+		if (evtIt->tick > 0)
+			break;
+		if (evtIt->evtType == 0xFF && evtIt->evtValA == 0x03)
+		{
+			// Event 'Track Name'
+			const char* data = reinterpret_cast<char*>(&evtIt->evtData[0]);
+			trkName = std::string(data, data + evtIt->evtData.size());
+			tNameEvtIt = evtIt;
+			break;
+		}
+	}
+	if (trkName.empty())
+		trkName = GenerateTkName(trkName, midiTrkID);
+	
+	trkID = 0;
+	for (trkIt = trkLst.begin(); trkIt != trkLst.end(); ++trkIt)
+	{
+		trkID ++;	// make numbers with base 1
+		if (trkIt->desc.empty())
+		{
+			char trkSubName[0x10];
+			sprintf(trkSubName, "#%.*u", trkNums, trkID);
+			trkIt->desc = std::string(trkSubName);
+		}
+		std::string newTrkName = trkName + " " + trkIt->desc;
+		
+		if (trkIt == trkLst.begin() && tNameEvtIt != trkIt->midTrk->GetEventEnd())
+		{
+			evtIt->evtData.resize(newTrkName.size());
+			memcpy(&evtIt->evtData[0], newTrkName.c_str(), newTrkName.size());
+		}
+		else
+		{
+			// insert as first event
+			trkIt->midTrk->InsertMetaEventD(trkIt->midTrk->GetEventEnd(), 0,
+				0x03, newTrkName.size(), newTrkName.c_str());
+		}
+	}
+	
+	return;
+}
+
+static void AddNoteToList(TrackSplit& trkSplt, trkinf_iterator trkIt, const MidiEvent& midEvt)
+{
+	NoteQueue& noteQ = trkSplt.activeNotes[((midEvt.evtType & 0x0F) << 7) | (midEvt.evtValA & 0x7F)];
+	ActiveNote newNote;
+	
+	if (noteQ.first == noteQ.notes.size())
+	{
+		// all notes were released - reuse the memory
+		noteQ.notes.clear();
+		noteQ.first = 0;
+	}
+	newNote.tick = midEvt.tick;
+	newNote.trkIt = trkIt;
+	noteQ.notes.push_back(newNote);
+	
+	return;
+}
+
+static trkinf_iterator RemoveNoteFromList(TrackSplit& trkSplt, midevt_iterator midEvt)
+{
+	NoteQueue& noteQ = trkSplt.activeNotes[((midEvt->evtType & 0x0F) << 7) | (midEvt->evtValA & 0x7F)];
+	size_t foundNote;
+	size_t curNote;
+	trkinf_iterator foundTrkIt;
+	
+	if (noteQ.first == noteQ.notes.size())
+		return trkSplt.trkList.end();	// note not found
+	
+	// The note is released on the last track that plays it, using the oldest note of that track.
+	// Usually there is only one note per channel/key playing, so this loop is short.
+	foundNote = noteQ.first;
+	for (curNote = foundNote + 1; curNote < noteQ.notes.size(); curNote ++)
+	{
+		if (noteQ.notes[curNote].trkIt->id > noteQ.notes[foundNote].trkIt->id)
+			foundNote = curNote;
+	}
+	
+	foundTrkIt = noteQ.notes[foundNote].trkIt;
+	if (foundNote == noteQ.first)
+		noteQ.first ++;
+	else
+		noteQ.notes.erase(noteQ.notes.begin() + foundNote);
+	return foundTrkIt;	// return track of NoteOn event
+}
+
+static void SplitTrackFunc(void* userData, size_t index)
+{
+	SplitJob* job = (SplitJob*)userData;
+	TrackSplit& curTS = job->trkSplt[index];
+	size_t curNote;
+	
+	curTS.activeNotes.resize(0x10 << 7);
+	for (curNote = 0; curNote < curTS.activeNotes.size(); curNote ++)
+		curTS.activeNotes[curNote].first = 0;
+	
+	switch(job->spltMode)
+	{
+	case SPLT_CHORD:
+		TrkSplit_Chord(curTS);
+		break;
+	case SPLT_BY_INS:
+		TrkSplit_Instrument(curTS);
+		break;
+	case SPLT_BY_CHN:
+		TrkSplit_Channel(curTS);
+		break;
+	case SPLT_BY_VEL:
+		TrkSplit_Velocity(curTS);
+		break;
+	case SPLT_BY_KEY:
+		TrkSplit_Key(curTS);
+		break;
+	}
+	std::vector<NoteQueue>().swap(curTS.activeNotes);	// free the memory
+	
+	ModifyTrackNames(curTS.trkList, (UINT16)index);
+	
+	return;
+}
+
+UINT8 SplitMidiTracks(MidiFile& midFile, UINT8 spltMode, UINT32 maxThreads)
+{
+	UINT16 trkCnt;
+	UINT16 curTrk;
+	std::vector<TrackSplit> trkSplt;
+	SplitJob splitJob;
+	UINT32 evtCount;
+	UINT16 newTrkID;
+	
+	trkCnt = midFile.GetTrackCount();
+	trkSplt.resize(trkCnt);
+	
+	evtCount = 0;
+	for (curTrk = 0; curTrk < trkCnt; curTrk ++)
+	{
+		MidiTrack* midiTrk = midFile.GetTrack(curTrk);
+		TrackSplit& curTS = trkSplt[curTrk];
+		
+		curTS.trkList.clear();
+		curTS.trkList.push_back(TrackInfo());
+		curTS.trkList.begin()->midTrk = midiTrk;
+		curTS.trkList.begin()->id = 0;
+		evtCount += midiTrk->GetEventCount();
+	}
+	
+	// The source tracks are split independently of each other, so this can be done by multiple threads.
+	// (In batch mode, the files are processed in parallel instead.)
+	splitJob.trkSplt = trkSplt.empty() ? NULL : &trkSplt[0];
+	splitJob.spltMode = spltMode;
+	RunParallel(trkCnt, &SplitTrackFunc, &splitJob, (evtCount < SPLIT_PARALLEL_MIN) ? 1 : maxThreads);
+	
+	// insert the new tracks in a fixed order, so that the result doesn't depend on the threads
+	newTrkID = 0;
+	for (curTrk = 0; curTrk < trkCnt; curTrk ++)
+	{
+		std::list<TrackInfo>& trkLst = trkSplt[curTrk].trkList;
+		
+		trkinf_iterator trkIt = trkLst.begin();
+		// skip first track
+		++trkIt;
+		newTrkID ++;
+		for (; trkIt != trkLst.end(); ++trkIt, newTrkID ++)
+		{
+			trkIt->midTrk->AppendMetaEvent(0, 0x2F, 0x00, NULL);
+			midFile.Track_Insert(newTrkID, trkIt->midTrk);
+		}
+	}
+	
+	trkSplt.clear();
+	
+	return 0x00;
+}
@@ -0,0 +1,22 @@
+#ifndef __MIDISPLTLIB_HPP__
+#define __MIDISPLTLIB_HPP__
+
+#include <stdtype.h>
+
+class MidiFile;
+
+enum SPLIT_MODES
+{
+	SPLT_BY_CHN = 0x00,
+	SPLT_CHORD = 0x01,
+	SPLT_BY_INS = 0x02,
+	SPLT_BY_VEL = 0x03,
+	SPLT_BY_KEY = 0x04,
+};
+
+// Splits every track of the file into multiple tracks (e.g. one per channel) and inserts
+// the new tracks after their source track.
+// maxThreads: for splitting the tracks concurrently (0 = one thread per CPU), small files use one thread
+UINT8 SplitMidiTracks(MidiFile& midFile, UINT8 spltMode, UINT32 maxThreads);
+
+#endif	// __MIDISPLTLIB_HPP__
@@ -0,0 +1,226 @@
+// Statistics for the MIDI tools (timing and counters)
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "psapi.lib")
+#endif
+#else
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+
+#include <stdtype.h>
+#include "MidiLib.hpp"
+#include "MidiStats.hpp"
+
+
+static const char* PHASE_NAMES[STATPH_COUNT] =
+{
+	"load", "process", "save",
+};
+static const char* EVENT_NAMES[STATEVT_COUNT] =
+{
+	"NoteOff", "NoteOn", "Aftertouch", "Control", "Program", "ChnPressure", "PitchBend",
+	"SysEx", "Meta",
+};
+
+
+static void PrintJSONString(FILE* hFile, const char* str);
+
+
+double GetStatsTime(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER freq;
+	LARGE_INTEGER counter;
+	
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&counter);
+	return (double)counter.QuadPart / freq.QuadPart;
+#else
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+#endif
+}
+
+UINT64 GetPeakMemory(void)
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+	
+	if (! GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+		return 0;
+	return pmc.PeakWorkingSetSize;
+#else
+	struct rusage usage;
+	
+	if (getrusage(RUSAGE_SELF, &usage))
+		return 0;
+#ifdef __APPLE__
+	return (UINT64)usage.ru_maxrss;	// bytes
+#else
+	return (UINT64)usage.ru_maxrss * 1024;	// kilobytes
+#endif
+#endif
+}
+
+UINT32 GetFileLength(const char* fileName)
+{
+#ifdef _MSC_VER
+	struct _stat fileStat;
+	if (_stat(fileName, &fileStat))
+		return 0;
+#else
+	struct stat fileStat;
+	if (stat(fileName, &fileStat))
+		return 0;
+#endif
+	return (UINT32)fileStat.st_size;
+}
+
+void ClearFileStats(FileStats* stats)
+{
+	if (stats == NULL)
+		return;
+	
+	memset(stats, 0x00, sizeof(FileStats));
+	stats->allocStart = GetAllocCount();
+	
+	return;
+}
+
+void EndFileStats(FileStats* stats)
+{
+	if (stats == NULL)
+		return;
+	
+	stats->evtAllocCount = GetAllocCount() - stats->allocStart;
+	
+	return;
+}
+
+void EndStatsPhase(FileStats* stats, UINT8 phase, double startTime)
+{
+	if (stats == NULL)
+		return;
+	
+	stats->phaseTime[phase] += GetStatsTime() - startTime;
+	
+	return;
+}
+
+void CountFileEvents(FileStats* stats, MidiFile& midFile)
+{
+	UINT16 curTrk;
+	
+	if (stats == NULL)
+		return;
+	
+	stats->trkCount = midFile.GetTrackCount();
+	for (curTrk = 0; curTrk < stats->trkCount; curTrk ++)
+	{
+		const MidiEvtList& evtList = midFile.GetTrack(curTrk)->GetEvents();
+		midevt_const_it evtIt;
+		
+		for (evtIt = evtList.begin(); evtIt != evtList.end(); ++evtIt)
+			CountEvent(stats, *evtIt);
+	}
+	
+	return;
+}
+
+void CountEvent(FileStats* stats, const MidiEvent& evt)
+{
+	if (stats == NULL)
+		return;
+	
+	if (evt.evtType < 0xF0)
+		stats->evtCount[(evt.evtType >> 4) & 0x07] ++;
+	else if (evt.evtType == 0xFF)
+		stats->evtCount[STATEVT_META] ++;
+	else
+		stats->evtCount[STATEVT_SYSEX] ++;
+	
+	return;
+}
+
+void PrintFileStats(const char* fileName, UINT8 result, const FileStats& stats, UINT8 mode)
+{
+	UINT32 evtTotal;
+	UINT8 curType;
+	UINT8 curPh;
+	
+	evtTotal = 0;
+	for (curType = 0; curType < STATEVT_COUNT; curType ++)
+		evtTotal += stats.evtCount[curType];
+	
+	if (mode == STATS_JSON)
+	{
+		fprintf(stderr, "{\"file\": ");
+		PrintJSONString(stderr, fileName);
+		fprintf(stderr, ", \"result\": %u, \"time_ms\": {", result);
+		for (curPh = 0; curPh < STATPH_COUNT; curPh ++)
+			fprintf(stderr, "%s\"%s\": %.3f", curPh ? ", " : "", PHASE_NAMES[curPh], stats.phaseTime[curPh] * 1000.0);
+		fprintf(stderr, "}, \"tracks\": %u, \"events\": {\"total\": %u", stats.trkCount, evtTotal);
+		for (curType = 0; curType < STATEVT_COUNT; curType ++)
+			fprintf(stderr, ", \"%s\": %u", EVENT_NAMES[curType], stats.evtCount[curType]);
+		fprintf(stderr, "}, \"bytes_read\": %u, \"bytes_written\": %u, \"evtdata_pool_allocations\": %u}\n",
+				stats.bytesRead, stats.bytesWritten, stats.evtAllocCount);
+	}
+	else if (mode == STATS_TEXT)
+	{
+		fprintf(stderr, "%s:", fileName);
+		if (result)
+			fprintf(stderr, " Error 0x%02X", result);
+		fprintf(stderr, "\n    Time:");
+		for (curPh = 0; curPh < STATPH_COUNT; curPh ++)
+			fprintf(stderr, "%s %s %.2f ms", curPh ? "," : "", PHASE_NAMES[curPh], stats.phaseTime[curPh] * 1000.0);
+		fprintf(stderr, "\n    %u tracks, %u events", stats.trkCount, evtTotal);
+		for (curType = 0; curType < STATEVT_COUNT; curType ++)
+		{
+			if (stats.evtCount[curType])
+				fprintf(stderr, ", %s %u", EVENT_NAMES[curType], stats.evtCount[curType]);
+		}
+		fprintf(stderr, "\n    %u bytes read, %u bytes written, %u MidiLib event-data/pool allocations\n",
+				stats.bytesRead, stats.bytesWritten, stats.evtAllocCount);
+	}
+	
+	return;
+}
+
+void PrintStatsSummary(UINT8 mode)
+{
+	if (mode == STATS_JSON)
+		fprintf(stderr, "{\"peak_memory\": %.0f}\n", (double)(INT64)GetPeakMemory());
+	else if (mode == STATS_TEXT)
+		fprintf(stderr, "Peak memory: %.1f MB\n", (INT64)GetPeakMemory() / 1048576.0);
+	
+	return;
+}
+
+static void PrintJSONString(FILE* hFile, const char* str)
+{
+	fputc('"', hFile);
+	for (; *str != '\0'; str ++)
+	{
+		if (*str == '"' || *str == '\\')
+			fprintf(hFile, "\\%c", *str);
+		else if ((UINT8)*str < 0x20)
+			fprintf(hFile, "\\u%04X", (UINT8)*str);
+		else
+			fputc(*str, hFile);
+	}
+	fputc('"', hFile);
+	
+	return;
+}
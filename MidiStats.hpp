@@ -0,0 +1,57 @@
+#ifndef __MIDISTATS_HPP__
+#define __MIDISTATS_HPP__
+
+#include <stdtype.h>
+
+class MidiFile;
+struct MidiEvent;
+
+#define STATS_OFF	0x00
+#define STATS_TEXT	0x01
+#define STATS_JSON	0x02
+
+#define STATPH_LOAD	0x00
+#define STATPH_PROCESS	0x01
+#define STATPH_SAVE	0x02
+#define STATPH_COUNT	0x03
+
+// event types: 0..6 = channel events 0x80..0xE0, 7 = SysEx, 8 = Meta
+#define STATEVT_SYSEX	0x07
+#define STATEVT_META	0x08
+#define STATEVT_COUNT	0x09
+
+// statistics of a single processed file
+struct FileStats
+{
+	double phaseTime[STATPH_COUNT];	// in seconds
+	UINT32 evtCount[STATEVT_COUNT];
+	UINT16 trkCount;
+	UINT32 bytesRead;
+	UINT32 bytesWritten;
+	UINT32 evtAllocCount;	// event-data/pool allocations done by MidiLib, see GetAllocCount()
+	UINT32 allocStart;	// GetAllocCount() at the time the statistics were cleared
+};
+
+// returns a timestamp in seconds, for measuring durations
+double GetStatsTime(void);
+// returns the peak memory usage of the process in bytes (0 = unknown)
+UINT64 GetPeakMemory(void);
+// returns the size of a file in bytes (0 = unknown)
+UINT32 GetFileLength(const char* fileName);
+
+// Note: All functions that take a FileStats pointer do nothing when it is NULL.
+// Note: ClearFileStats/EndFileStats must be called by the thread that processes the file.
+void ClearFileStats(FileStats* stats);
+// finishes the statistics after processing the file (event-data/pool allocation count)
+void EndFileStats(FileStats* stats);
+// adds the time since startTime to the phase
+void EndStatsPhase(FileStats* stats, UINT8 phase, double startTime);
+void CountFileEvents(FileStats* stats, MidiFile& midFile);
+void CountEvent(FileStats* stats, const MidiEvent& evt);
+
+// The statistics are printed to stderr, so that they don't mix with the messages of the tools.
+// JSON mode prints a single line with a JSON object per file.
+void PrintFileStats(const char* fileName, UINT8 result, const FileStats& stats, UINT8 mode);
+void PrintStatsSummary(UINT8 mode);
+
+#endif	// __MIDISTATS_HPP__
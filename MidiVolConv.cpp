@@ -1,73 +1,28 @@
-#define _USE_MATH_DEFINES
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <vector>
 #include <ctype.h>	// for tolower()
-#include <string.h>	// for stricmp
-#include <math.h>
+#include <string.h>	// for strcmp()
+#include <stdlib.h>
 
 #include <stdtype.h>
 #include "MidiLib.hpp"
-
-#ifndef M_PI
-#define M_PI	3.14159265358979323846
-#endif
-#ifndef M_LN2
-#define M_LN2	0.693147180559945309417
-#endif
-#ifndef M_LN10
-#define M_LN10	2.30258509299404568402
-#endif
-
-#ifdef _MSC_VER
-#define stricmp		_stricmp
-#else
-#define stricmp		strcasecmp
-#endif
+#include "MidiBatch.hpp"
+#include "MidiStats.hpp"
+#include "MidiVolConvLib.hpp"
 
 // Function Prototypes
-static UINT8 GetVolAlgoName(const char* algoName);
-void MidiVolConv(void);
-static double GetDBVol(UINT8 inVol);
-static UINT8 GetMIDIVol(double dbVol, bool noVol0);
-static UINT8 VolConv(UINT8 inVol, bool noVol0);
-
+static UINT8 ProcessFile(const char* inFileName, const char* outFileName, FileStats* stats);
+static UINT8 ReadFileData(const char* fileName, std::vector<UINT8>& fileData);
 
-struct VOLALGO_LIST
-{
-	UINT8 id;
-	const char* name;
-};
 
-#define VOLALGO_GM		0x00
-#define VOLALGO_LIN		0x01
-#define VOLALGO_FM		0x02
-#define VOLALGO_PSG_2DB	0x03
-#define VOLALGO_PSG_3DB	0x04
-#define VOLALGO_WINFM	0x05
-
-static const VOLALGO_LIST VolAlgoList[] =
-{
-	{VOLALGO_GM, "GM"},
-	{VOLALGO_LIN, "Lin"},
-	{VOLALGO_FM, "FM"},
-	{VOLALGO_PSG_2DB, "PSG2"},
-	{VOLALGO_PSG_3DB, "PSG3"},
-	{VOLALGO_WINFM, "WinFM"},
-	{0x00, NULL}
-};
-
-#define VOLEVT_VELOCITY		0x01
-#define VOLEVT_VOLUME		0x02
-#define VOLEVT_EXPRESSION	0x04
-#define VOLEVT_ALL			(VOLEVT_VELOCITY | VOLEVT_VOLUME | VOLEVT_EXPRESSION)
-
-static UINT8 VOLEVT_MASK;
-static UINT16 CHANNEL_MASK;
-static UINT8 INVOL_ALGO;
-static UINT8 OUTVOL_ALGO;
-static double VOL_GAIN;
-MidiFile CMidi;
+static VOLCONV_OPTS VOL_OPTS;
+static bool PATCH_MODE;
+static bool COMPACT_OUTPUT;
+static bool BATCH_MODE;
+static UINT32 BATCH_THREADS;
+static UINT8 STATS_MODE;
 
 int main(int argc, char* argv[])
 {
@@ -78,12 +33,19 @@ int main(int argc, char* argv[])
 	if (argc < 3)
 	{
 		std::cout << "Usage: " << argv[0] << " [options] input.mid output.mid\n";
+		std::cout << "       " << argv[0] << " [options] -b input_dir/list.txt output_dir\n";
 		std::cout << "Options:\n";
 		std::cout << "    -s Algo - set volume algorithm (source/input) (default: -s GM)\n";
 		std::cout << "    -d Algo - set volume algorithm (destination/output) (default: -d GM)\n";
 	//	std::cout << "    -e evts - convert specified events only (default: -e Vel,Vol,Exp)\n";
 	//	std::cout << "              Vel = Note Velocity, Vol = Volume Ctrl, Exp = Expression Ctrl\n";
 		std::cout << "    -g gain - change volume by gain (in db, default: 0)\n";
+		std::cout << "    -p      - patch mode: only rewrite the volume bytes, keep everything else\n";
+		std::cout << "    -c      - compact output: use Running Status wherever possible (not with -p)\n";
+		std::cout << "    -b      - batch mode: process all files of a directory or list file\n";
+		std::cout << "    -j num  - number of threads for batch mode (default: one per CPU)\n";
+		std::cout << "    --stats - print statistics (time per phase, event counts, file sizes) to stderr\n";
+		std::cout << "              --stats=json prints one JSON object per file\n";
 		std::cout << "Algorithms:\n";
 		std::cout << "    GM    - General MIDI algorithm\n";
 		std::cout << "    Lin   - linear volume (127 = max, 64 = half volume)\n";
@@ -98,16 +60,29 @@ int main(int argc, char* argv[])
 	}
 	
 	argbase = 1;
-	VOLEVT_MASK = VOLEVT_ALL;
-	CHANNEL_MASK = 0xFFFF;	// all 16 channels active
-	INVOL_ALGO = VOLALGO_GM;
-	OUTVOL_ALGO = VOLALGO_GM;
-	VOL_GAIN = 0.0;
+	VOL_OPTS.evtMask = VOLEVT_ALL;
+	VOL_OPTS.chnMask = 0xFFFF;	// all 16 channels active
+	VOL_OPTS.inAlgo = VOLALGO_GM;
+	VOL_OPTS.outAlgo = VOLALGO_GM;
+	VOL_OPTS.gain = 0.0;
+	PATCH_MODE = false;
+	COMPACT_OUTPUT = false;
+	BATCH_MODE = false;
+	BATCH_THREADS = 0;
+	STATS_MODE = STATS_OFF;
 	while(argbase < argc && argv[argbase][0] == '-')
 	{
 		char optChr = tolower(argv[argbase][1]);
 		
-		if (optChr == 's' || optChr == 'd')
+		if (! strcmp(argv[argbase], "--stats"))
+		{
+			STATS_MODE = STATS_TEXT;
+		}
+		else if (! strcmp(argv[argbase], "--stats=json"))
+		{
+			STATS_MODE = STATS_JSON;
+		}
+		else if (optChr == 's' || optChr == 'd')
 		{
 			argbase ++;
 			if (argbase >= argc)
@@ -120,9 +95,9 @@ int main(int argc, char* argv[])
 				break;
 			}
 			if (optChr == 's')
-				INVOL_ALGO = algoID;
+				VOL_OPTS.inAlgo = algoID;
 			else if (optChr == 'd')
-				OUTVOL_ALGO = algoID;
+				VOL_OPTS.outAlgo = algoID;
 		}
 		else if (optChr == 'e')
 		{
@@ -135,7 +110,26 @@ int main(int argc, char* argv[])
 			argbase ++;
 			if (argbase >= argc)
 				break;
-			VOL_GAIN = strtod(argv[argbase], NULL);
+			VOL_OPTS.gain = strtod(argv[argbase], NULL);
+		}
+		else if (optChr == 'p')
+		{
+			PATCH_MODE = true;
+		}
+		else if (optChr == 'c')
+		{
+			COMPACT_OUTPUT = true;
+		}
+		else if (optChr == 'b')
+		{
+			BATCH_MODE = true;
+		}
+		else if (optChr == 'j')
+		{
+			argbase ++;
+			if (argbase >= argc)
+				break;
+			BATCH_THREADS = (UINT32)strtoul(argv[argbase], NULL, 0);
 		}
 		else
 		{
@@ -151,28 +145,25 @@ int main(int argc, char* argv[])
 	
 	UINT8 retVal;
 	
-	std::cout << "Opening ...\n";
-	retVal = CMidi.LoadFile(argv[argbase + 0]);
-	if (retVal)
+	if (BATCH_MODE)
 	{
-		std::cout << "Error opening file!\n";
-		std::cout << "Errorcode: " << retVal;
-		return retVal;
+		UINT32 errCnt = RunBatch(argv[argbase + 0], argv[argbase + 1], BATCH_THREADS, &ProcessFile, STATS_MODE);
+		return errCnt ? 1 : 0;
 	}
 	
-	MidiVolConv();
+	FileStats stats;
 	
-	std::cout << "Saving ...\n";
-	retVal = CMidi.SaveFile(argv[argbase + 1]);
-	if (retVal)
+	ClearFileStats(&stats);
+	retVal = ProcessFile(argv[argbase + 0], argv[argbase + 1], (STATS_MODE != STATS_OFF) ? &stats : NULL);
+	EndFileStats(&stats);
+	if (STATS_MODE != STATS_OFF)
 	{
-		std::cout << "Error saving file!\n";
-		std::cout << "Errorcode: " << retVal;
-		return retVal;
+		std::cout << std::flush;
+		PrintFileStats(argv[argbase + 0], retVal, stats, STATS_MODE);
+		PrintStatsSummary(STATS_MODE);
 	}
-	
-	std::cout << "Cleaning ...\n";
-	CMidi.ClearAll();
+	if (retVal)
+		return retVal;
 	std::cout << "Done.\n";
 #ifdef _DEBUG
 	getchar();
@@ -181,138 +172,122 @@ int main(int argc, char* argv[])
 	return 0;
 }
 
-static UINT8 GetVolAlgoName(const char* algoName)
+// Note: Messages are printed in single-file mode only, as multiple files are processed at once in batch mode.
+static UINT8 ProcessFile(const char* inFileName, const char* outFileName, FileStats* stats)
 {
-	const VOLALGO_LIST* tempAlgo;
+	MidiEvtReader midiIn;
+	MidiEvtWriter midiOut;
+	std::vector<UINT8> inData;
+	double startTime;
+	UINT8 retVal;
 	
-	for (tempAlgo = VolAlgoList; tempAlgo->name != NULL; tempAlgo ++)
+	if (PATCH_MODE)
 	{
-		if (! stricmp(algoName, tempAlgo->name))
-			return tempAlgo->id;
+		if (! BATCH_MODE)
+			std::cout << "Patching ...\n";
+		retVal = MidiVolPatch(inFileName, outFileName, VOL_OPTS, stats);
+		if (retVal && ! BATCH_MODE)
+		{
+			std::cout << "Error patching file!\n";
+			std::cout << "Errorcode: " << retVal;
+		}
+		return retVal;
 	}
-	return 0xFF;
-}
-
-void MidiVolConv(void)
-{
-	UINT16 trkCnt;
-	UINT16 curTrk;
 	
-	trkCnt = CMidi.GetTrackCount();
-	for (curTrk = 0; curTrk < trkCnt; curTrk ++)
+	if (! BATCH_MODE)
+		std::cout << "Opening ...\n";
+	startTime = GetStatsTime();
+	// The input file stays mapped while the output is written, unless we overwrite it.
+	if (! IsSameFile(inFileName, outFileName))
 	{
-		MidiTrack* midiTrk = CMidi.GetTrack(curTrk);
-		midevt_iterator evtIt;
-		
-		for (evtIt = midiTrk->GetEventBegin(); evtIt != midiTrk->GetEventEnd(); ++evtIt)
+		retVal = midiIn.OpenFile(inFileName);
+	}
+	else
+	{
+		retVal = ReadFileData(inFileName, inData);
+		if (! retVal)
+			retVal = midiIn.OpenBuffer((UINT32)inData.size(), &inData[0x00]);
+	}
+	if (retVal)
+	{
+		if (! BATCH_MODE)
 		{
-			UINT8 evtChn = evtIt->evtType & 0x0F;
-			switch(evtIt->evtType & 0xF0)
-			{
-			case 0x80:
-			case 0x90:
-				if (! (CHANNEL_MASK & (1 << evtChn)))
-					break;
-				if ((VOLEVT_MASK & VOLEVT_VELOCITY) && evtIt->evtValB > 0)
-					evtIt->evtValB = VolConv(evtIt->evtValB, true);
-				break;
-			case 0xB0:
-				if (! (CHANNEL_MASK & (1 << evtChn)))
-					break;
-				switch(evtIt->evtValA)
-				{
-				case 0x07:
-					if ((VOLEVT_MASK & VOLEVT_VOLUME) && evtIt->evtValB > 0)
-						evtIt->evtValB = VolConv(evtIt->evtValB, false);
-					break;
-				case 0x0B:
-					if ((VOLEVT_MASK & VOLEVT_EXPRESSION) && evtIt->evtValB > 0)
-						evtIt->evtValB = VolConv(evtIt->evtValB, false);
-					break;
-				}
-				break;
-			}
-		}	// end while(evtIt)
+			std::cout << "Error opening file!\n";
+			std::cout << "Errorcode: " << retVal;
+		}
+		return retVal;
+	}
+	retVal = midiOut.OpenFile(outFileName, midiIn.GetMidiFormat(), midiIn.GetMidiResolution(), COMPACT_OUTPUT);
+	EndStatsPhase(stats, STATPH_LOAD, startTime);
+	if (retVal)
+	{
+		if (! BATCH_MODE)
+		{
+			std::cout << "Error saving file!\n";
+			std::cout << "Errorcode: " << retVal;
+		}
+		return retVal;
 	}
 	
-	return;
-}
-
-static double GetDBVol(UINT8 inVol)
-{
-	switch(INVOL_ALGO)
+	if (! BATCH_MODE)
+		std::cout << "Converting ...\n";
+	if (stats != NULL)
+	{
+		stats->trkCount = midiIn.GetTrackCount();
+		stats->bytesRead = GetFileLength(inFileName);
+	}
+	// The output is written while converting, so only closing the file counts as saving.
+	startTime = GetStatsTime();
+	retVal = MidiVolConv(midiIn, midiOut, VOL_OPTS, stats);
+	EndStatsPhase(stats, STATPH_PROCESS, startTime);
+	if (! retVal)
+	{
+		startTime = GetStatsTime();
+		retVal = midiOut.Close();
+		EndStatsPhase(stats, STATPH_SAVE, startTime);
+	}
+	if (retVal)
 	{
-	case VOLALGO_GM:	// General MIDI scale
-		return 40.0 * log(inVol / 127.0) / M_LN10;
-	case VOLALGO_LIN:	// linear scale
-		return 6.0 * log(inVol / 127.0) / M_LN2;
-	case VOLALGO_FM:	// FM OPx scale (0.75 db per step)
-		return (inVol - 0x7F) / 8.0 * 6.0;
-	case VOLALGO_PSG_2DB:	// PSG scale (8 values, one step, 2 db)
-		inVol /= 0x08;	// truncate low 3 bits
-		return (inVol - 0x0F) * 2.0;
-	case VOLALGO_PSG_3DB:	// PSG scale (8 values, one step, 3 db)
-		inVol /= 0x08;	// truncate low 3 bits
-		return (inVol - 0x0F) * 3.0;
-	case VOLALGO_WINFM:
+		midiOut.Close();
+		remove(outFileName);
+		if (! BATCH_MODE)
 		{
-			double volPerc = inVol / 127.0;
-			double a2 = sin(volPerc * (M_PI / 2.0));
-			double a3 = sqrt(a2) * 0.9;
-			double oplTL = 0x3F * (1.0 - a3);
-			return oplTL / 8.0 * -6.0 + 4.725;	// add 4.725 to make up for the *0.9 above
+			std::cout << "Error converting file!\n";
+			std::cout << "Errorcode: " << retVal;
 		}
+		return retVal;
 	}
+	if (stats != NULL)
+		stats->bytesWritten = GetFileLength(outFileName);
+	
+	if (! BATCH_MODE)
+		std::cout << "Cleaning ...\n";
+	midiIn.Close();
 	
-	return 0.0;
+	return 0x00;
 }
 
-static UINT8 GetMIDIVol(double dbVol, bool noVol0)
+static UINT8 ReadFileData(const char* fileName, std::vector<UINT8>& fileData)
 {
-	double volVal;
-	UINT8 midVol;
+	FILE* infile;
+	long fileSize;
 	
-	switch(OUTVOL_ALGO)
+	infile = fopen(fileName, "rb");
+	if (infile == NULL)
+		return 0xFF;
+	
+	fseek(infile, 0, SEEK_END);
+	fileSize = ftell(infile);
+	fseek(infile, 0, SEEK_SET);
+	if (fileSize <= 0)
 	{
-	case VOLALGO_GM:	// General MIDI scale
-		volVal = pow(10.0, dbVol / 40.0);
-		break;
-	case VOLALGO_LIN:	// linear scale
-		volVal = pow(2.0, dbVol / 6.0);
-		break;
-	case VOLALGO_FM:	// FM OPx scale (0.75 db per step)
-		volVal = (dbVol / 6.0 * 8.0 + 127) / 127.0;
-		break;
-	case VOLALGO_PSG_2DB:	// PSG scale (8 values, one step, 2 db)
-		volVal = (dbVol / 2.0 * 8.0 + 120) / 120.0;
-		break;
-	case VOLALGO_PSG_3DB:	// PSG scale (8 values, one step, 3 db)
-		volVal = (dbVol / 3.0 * 8.0 + 120) / 120.0;
-		break;
-	case VOLALGO_WINFM:
-		{
-			double oplTL = (dbVol - 4.725) / -6.0 * 8.0;
-			double a3 = 1.0 - oplTL / 0x3F;
-			double a2 = pow(a3 / 0.9, 2);
-			volVal = asin(a2) / (M_PI / 2.0);
-			break;
-		}
-	default:
-		volVal = 1.0;
-		break;
+		fclose(infile);
+		return 0x10;
 	}
-	if (volVal < 0.0)
-		volVal = 0.0;
-	else if (volVal > 1.0)
-		volVal = 1.0;
+	fileData.resize(fileSize);
+	fileData.resize(fread(&fileData[0x00], 0x01, fileData.size(), infile));
+	fclose(infile);
 	
-	midVol = (UINT8)(volVal * 0x7F + 0.5);
-	if (noVol0 && midVol == 0)
-		midVol = 1;
-	return midVol;
+	return fileData.empty() ? 0x10 : 0x00;
 }
 
-static UINT8 VolConv(UINT8 inVol, bool noVol0)
-{
-	return GetMIDIVol(GetDBVol(inVol) + VOL_GAIN, noVol0);
-}
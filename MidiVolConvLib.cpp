@@ -0,0 +1,364 @@
+// Volume conversion of the MIDI Volume Converter
+#define _USE_MATH_DEFINES
+#include <vector>
+#include <stdio.h>
+#include <string.h>	// for stricmp
+#include <math.h>
+
+#include <stdtype.h>
+#include "MidiLib.hpp"
+#include "MidiStats.hpp"
+#include "MidiVolConvLib.hpp"
+
+#ifndef M_PI
+#define M_PI	3.14159265358979323846
+#endif
+#ifndef M_LN2
+#define M_LN2	0.693147180559945309417
+#endif
+#ifndef M_LN10
+#define M_LN10	2.30258509299404568402
+#endif
+
+#ifdef _MSC_VER
+#define stricmp		_stricmp
+#else
+#define stricmp		strcasecmp
+#endif
+
+struct VOL_PATCH
+{
+	UINT32 offset;	// file offset of the volume byte
+	UINT8 value;
+};
+
+struct VOLALGO_LIST
+{
+	UINT8 id;
+	const char* name;
+};
+
+// Function Prototypes
+static UINT8 CopyFileData(const char* srcName, const char* dstName);
+static UINT8 PatchFile(const char* inFileName, const char* outFileName, const std::vector<VOL_PATCH>& patchList);
+static UINT8 GetVolPatches(MidiEvtReader& midiIn, const VOLCONV_OPTS& opts, std::vector<VOL_PATCH>& patchList, FileStats* stats);
+static void VolConvEvent(const VOLCONV_OPTS& opts, MidiEvent& evt);
+static double GetDBVol(UINT8 algo, UINT8 inVol);
+static UINT8 GetMIDIVol(UINT8 algo, double dbVol, bool noVol0);
+static UINT8 VolConv(const VOLCONV_OPTS& opts, UINT8 inVol, bool noVol0);
+
+
+static const VOLALGO_LIST VolAlgoList[] =
+{
+	{VOLALGO_GM, "GM"},
+	{VOLALGO_LIN, "Lin"},
+	{VOLALGO_FM, "FM"},
+	{VOLALGO_PSG_2DB, "PSG2"},
+	{VOLALGO_PSG_3DB, "PSG3"},
+	{VOLALGO_WINFM, "WinFM"},
+	{0x00, NULL}
+};
+
+UINT8 GetVolAlgoName(const char* algoName)
+{
+	const VOLALGO_LIST* tempAlgo;
+	
+	for (tempAlgo = VolAlgoList; tempAlgo->name != NULL; tempAlgo ++)
+	{
+		if (! stricmp(algoName, tempAlgo->name))
+			return tempAlgo->id;
+	}
+	return 0xFF;
+}
+
+UINT8 MidiVolConv(MidiEvtReader& midiIn, MidiEvtWriter& midiOut, const VOLCONV_OPTS& opts, FileStats* stats)
+{
+	UINT16 trkCnt;
+	UINT16 curTrk;
+	MidiEvent midiEvt;
+	UINT8 retVal;
+	
+	// events are converted while copying them, so only one event is kept in memory
+	trkCnt = midiIn.GetTrackCount();
+	for (curTrk = 0; curTrk < trkCnt; curTrk ++)
+	{
+		retVal = midiIn.NextTrack();
+		if (retVal)
+			return retVal;
+		retVal = midiOut.BeginTrack();
+		if (retVal)
+			return retVal;
+		
+		while(true)
+		{
+			retVal = midiIn.ReadEvent(midiEvt);
+			if (retVal == 0xFF)
+				break;	// end of track
+			else if (retVal)
+				return retVal;
+			
+			CountEvent(stats, midiEvt);
+			VolConvEvent(opts, midiEvt);
+			retVal = midiOut.WriteEvent(midiEvt);
+			if (retVal)
+				return retVal;
+		}
+		
+		retVal = midiOut.EndTrack();
+		if (retVal)
+			return retVal;
+	}
+	
+	return 0x00;
+}
+
+static void VolConvEvent(const VOLCONV_OPTS& opts, MidiEvent& evt)
+{
+	UINT8 evtChn = evt.evtType & 0x0F;
+	switch(evt.evtType & 0xF0)
+	{
+	case 0x80:
+	case 0x90:
+		if (! (opts.chnMask & (1 << evtChn)))
+			break;
+		if ((opts.evtMask & VOLEVT_VELOCITY) && evt.evtValB > 0)
+			evt.evtValB = VolConv(opts, evt.evtValB, true);
+		break;
+	case 0xB0:
+		if (! (opts.chnMask & (1 << evtChn)))
+			break;
+		switch(evt.evtValA)
+		{
+		case 0x07:
+			if ((opts.evtMask & VOLEVT_VOLUME) && evt.evtValB > 0)
+				evt.evtValB = VolConv(opts, evt.evtValB, false);
+			break;
+		case 0x0B:
+			if ((opts.evtMask & VOLEVT_EXPRESSION) && evt.evtValB > 0)
+				evt.evtValB = VolConv(opts, evt.evtValB, false);
+			break;
+		}
+		break;
+	}
+	
+	return;
+}
+
+static UINT8 CopyFileData(const char* srcName, const char* dstName)
+{
+	FILE* hFileSrc;
+	FILE* hFileDst;
+	std::vector<UINT8> copyBuf(0x10000);
+	size_t readBytes;
+	UINT8 retVal;
+	
+	// opening the destination would truncate the source
+	if (IsSameFile(srcName, dstName))
+		return 0xFF;
+	hFileSrc = fopen(srcName, "rb");
+	if (hFileSrc == NULL)
+		return 0xFF;
+	hFileDst = fopen(dstName, "wb");
+	if (hFileDst == NULL)
+	{
+		fclose(hFileSrc);
+		return 0xFF;
+	}
+	
+	retVal = 0x00;
+	do
+	{
+		readBytes = fread(&copyBuf[0x00], 0x01, copyBuf.size(), hFileSrc);
+		if (fwrite(&copyBuf[0x00], 0x01, readBytes, hFileDst) < readBytes)
+		{
+			retVal = 0xFF;
+			break;
+		}
+	} while(readBytes == copyBuf.size());
+	
+	fclose(hFileDst);
+	fclose(hFileSrc);
+	
+	return retVal;
+}
+
+UINT8 MidiVolPatch(const char* inFileName, const char* outFileName, const VOLCONV_OPTS& opts, FileStats* stats)
+{
+	MidiEvtReader midiIn;
+	std::vector<VOL_PATCH> patchList;
+	double startTime;
+	UINT8 retVal;
+	
+	// scan the whole input first, so that invalid files are never modified
+	startTime = GetStatsTime();
+	retVal = midiIn.OpenFile(inFileName);
+	EndStatsPhase(stats, STATPH_LOAD, startTime);
+	if (retVal)
+		return retVal;
+	if (stats != NULL)
+	{
+		stats->trkCount = midiIn.GetTrackCount();
+		stats->bytesRead = GetFileLength(inFileName);
+	}
+	startTime = GetStatsTime();
+	retVal = GetVolPatches(midiIn, opts, patchList, stats);
+	midiIn.Close();
+	EndStatsPhase(stats, STATPH_PROCESS, startTime);
+	if (retVal)
+		return retVal;
+	
+	startTime = GetStatsTime();
+	retVal = PatchFile(inFileName, outFileName, patchList);
+	EndStatsPhase(stats, STATPH_SAVE, startTime);
+	if (! retVal && stats != NULL)
+		stats->bytesWritten = GetFileLength(outFileName);
+	
+	return retVal;
+}
+
+static UINT8 PatchFile(const char* inFileName, const char* outFileName, const std::vector<VOL_PATCH>& patchList)
+{
+	MidiEvtReader midiIn;
+	size_t curPatch;
+	UINT8 retVal;
+	
+	if (! IsSameFile(inFileName, outFileName))
+	{
+		retVal = CopyFileData(inFileName, outFileName);
+		if (retVal)
+		{
+			remove(outFileName);
+			return retVal;
+		}
+	}
+	if (patchList.empty())
+		return 0x00;
+	
+	retVal = midiIn.OpenFile(outFileName, true);
+	if (retVal)
+		return retVal;
+	for (curPatch = 0; curPatch < patchList.size(); curPatch ++)
+		midiIn.PatchData(patchList[curPatch].offset, patchList[curPatch].value);
+	midiIn.Close();
+	
+	return 0x00;
+}
+
+static UINT8 GetVolPatches(MidiEvtReader& midiIn, const VOLCONV_OPTS& opts, std::vector<VOL_PATCH>& patchList, FileStats* stats)
+{
+	UINT16 trkCnt;
+	UINT16 curTrk;
+	MidiEvent midiEvt;
+	VOL_PATCH volPatch;
+	UINT8 oldVol;
+	UINT8 retVal;
+	
+	trkCnt = midiIn.GetTrackCount();
+	for (curTrk = 0; curTrk < trkCnt; curTrk ++)
+	{
+		retVal = midiIn.NextTrack();
+		if (retVal)
+			return retVal;
+		
+		while(true)
+		{
+			retVal = midiIn.ReadEvent(midiEvt);
+			if (retVal == 0xFF)
+				break;	// end of track
+			else if (retVal)
+				return retVal;
+			
+			CountEvent(stats, midiEvt);
+			// Only the 2nd data byte is changed, so the event keeps its size.
+			oldVol = midiEvt.evtValB;
+			VolConvEvent(opts, midiEvt);
+			if (midiEvt.evtValB != oldVol)
+			{
+				volPatch.offset = midiIn.GetEventOffset() + midiIn.GetEventSize() - 1;
+				volPatch.value = midiEvt.evtValB;
+				patchList.push_back(volPatch);
+			}
+		}
+	}
+	
+	return 0x00;
+}
+
+static double GetDBVol(UINT8 algo, UINT8 inVol)
+{
+	switch(algo)
+	{
+	case VOLALGO_GM:	// General MIDI scale
+		return 40.0 * log(inVol / 127.0) / M_LN10;
+	case VOLALGO_LIN:	// linear scale
+		return 6.0 * log(inVol / 127.0) / M_LN2;
+	case VOLALGO_FM:	// FM OPx scale (0.75 db per step)
+		return (inVol - 0x7F) / 8.0 * 6.0;
+	case VOLALGO_PSG_2DB:	// PSG scale (8 values, one step, 2 db)
+		inVol /= 0x08;	// truncate low 3 bits
+		return (inVol - 0x0F) * 2.0;
+	case VOLALGO_PSG_3DB:	// PSG scale (8 values, one step, 3 db)
+		inVol /= 0x08;	// truncate low 3 bits
+		return (inVol - 0x0F) * 3.0;
+	case VOLALGO_WINFM:
+		{
+			double volPerc = inVol / 127.0;
+			double a2 = sin(volPerc * (M_PI / 2.0));
+			double a3 = sqrt(a2) * 0.9;
+			double oplTL = 0x3F * (1.0 - a3);
+			return oplTL / 8.0 * -6.0 + 4.725;	// add 4.725 to make up for the *0.9 above
+		}
+	}
+	
+	return 0.0;
+}
+
+static UINT8 GetMIDIVol(UINT8 algo, double dbVol, bool noVol0)
+{
+	double volVal;
+	UINT8 midVol;
+	
+	switch(algo)
+	{
+	case VOLALGO_GM:	// General MIDI scale
+		volVal = pow(10.0, dbVol / 40.0);
+		break;
+	case VOLALGO_LIN:	// linear scale
+		volVal = pow(2.0, dbVol / 6.0);
+		break;
+	case VOLALGO_FM:	// FM OPx scale (0.75 db per step)
+		volVal = (dbVol / 6.0 * 8.0 + 127) / 127.0;
+		break;
+	case VOLALGO_PSG_2DB:	// PSG scale (8 values, one step, 2 db)
+		volVal = (dbVol / 2.0 * 8.0 + 120) / 120.0;
+		break;
+	case VOLALGO_PSG_3DB:	// PSG scale (8 values, one step, 3 db)
+		volVal = (dbVol / 3.0 * 8.0 + 120) / 120.0;
+		break;
+	case VOLALGO_WINFM:
+		{
+			double oplTL = (dbVol - 4.725) / -6.0 * 8.0;
+			double a3 = 1.0 - oplTL / 0x3F;
+			double a2 = pow(a3 / 0.9, 2);
+			volVal = asin(a2) / (M_PI / 2.0);
+			break;
+		}
+	default:
+		volVal = 1.0;
+		break;
+	}
+	if (volVal < 0.0)
+		volVal = 0.0;
+	else if (volVal > 1.0)
+		volVal = 1.0;
+	
+	midVol = (UINT8)(volVal * 0x7F + 0.5);
+	if (noVol0 && midVol == 0)
+		midVol = 1;
+	return midVol;
+}
+
+static UINT8 VolConv(const VOLCONV_OPTS& opts, UINT8 inVol, bool noVol0)
+{
+	return GetMIDIVol(opts.outAlgo, GetDBVol(opts.inAlgo, inVol) + opts.gain, noVol0);
+}
@@ -0,0 +1,39 @@
+#ifndef __MIDIVOLCONVLIB_HPP__
+#define __MIDIVOLCONVLIB_HPP__
+
+#include <stdtype.h>
+
+class MidiEvtReader;
+class MidiEvtWriter;
+struct FileStats;
+
+#define VOLALGO_GM		0x00
+#define VOLALGO_LIN		0x01
+#define VOLALGO_FM		0x02
+#define VOLALGO_PSG_2DB	0x03
+#define VOLALGO_PSG_3DB	0x04
+#define VOLALGO_WINFM	0x05
+
+#define VOLEVT_VELOCITY		0x01
+#define VOLEVT_VOLUME		0x02
+#define VOLEVT_EXPRESSION	0x04
+#define VOLEVT_ALL			(VOLEVT_VELOCITY | VOLEVT_VOLUME | VOLEVT_EXPRESSION)
+
+struct VOLCONV_OPTS
+{
+	UINT8 evtMask;	// VOLEVT_* flags, events to be converted
+	UINT16 chnMask;	// bit n set = convert channel n
+	UINT8 inAlgo;	// VOLALGO_* of the input
+	UINT8 outAlgo;	// VOLALGO_* of the output
+	double gain;	// in db
+};
+
+// returns the VOLALGO_* ID for an algorithm name (e.g. "GM"), 0xFF = unknown
+UINT8 GetVolAlgoName(const char* algoName);
+// copies all tracks from midiIn to midiOut and converts the volume of the events
+// Note: midiIn must be freshly opened, midiOut is not closed.
+UINT8 MidiVolConv(MidiEvtReader& midiIn, MidiEvtWriter& midiOut, const VOLCONV_OPTS& opts, FileStats* stats);
+// patch mode: copies the file (unless both names refer to the same file) and rewrites only the volume bytes
+UINT8 MidiVolPatch(const char* inFileName, const char* outFileName, const VOLCONV_OPTS& opts, FileStats* stats);
+
+#endif	// __MIDIVOLCONVLIB_HPP__